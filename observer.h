@@ -20,14 +20,34 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+#pragma once
 
-#include <set>
+#include <array>
 #include <vector>
 #include <tuple>
 #include <algorithm>
 #include <memory>
 #include <functional>
 #include <utility>
+#include <type_traits>
+#include <iterator>
+#include <cstdint>
+#include <new>
+
+#if defined( PG_OBSERVER_METERING )
+#include "observer_meter.h"
+#endif
+
+// Static tracepoints for perf and bpftrace, e.g. 'usdt:./app:pg_observer:notify_entry'.
+// They compile to a NOP in the instruction stream until a tracer attaches.
+#if defined( PG_OBSERVER_USDT )
+#include <sys/sdt.h>
+#define PG_OBSERVER_PROBE2( name, a1, a2 )     DTRACE_PROBE2( pg_observer, name, a1, a2 )
+#define PG_OBSERVER_PROBE3( name, a1, a2, a3 ) DTRACE_PROBE3( pg_observer, name, a1, a2, a3 )
+#else
+#define PG_OBSERVER_PROBE2( name, a1, a2 )
+#define PG_OBSERVER_PROBE3( name, a1, a2, a3 )
+#endif
 
 
 namespace pg
@@ -73,28 +93,98 @@ constexpr decltype( auto ) get_first_n( A && ... args )
 
 }
 
-class observer_owner;
+class observer_handle;
+
+namespace pg_detail
+{
+
+class owner_base;
+
+template< typename ...A >
+class subject_base;
+
+template< typename ...A >
+class compact_subject_base;
 
 template< typename ...A >
-class subject;
+class observer_slots;
+
+template< typename LIST >
+class scoped_observer;
+
+}
+
+template< typename HOOKS >
+class basic_observer_owner;
+
+template< typename HOOKS, typename ...A >
+class basic_subject;
+
+template< typename HOOKS, typename ...A >
+class basic_compact_subject;
 
 template< typename SUBJECT >
 class subject_blocker;
 
+class scoped_connection;
+
+// Identifies a connection made by an observer owner. Disconnecting a connection
+// that is already gone, because it was disconnected before or because its subject
+// was destroyed, does nothing.
+struct connection
+{
+    std::uint32_t index      = 0;
+    std::uint32_t generation = 0;
+};
+
+// The default hook policy of subjects and observer owners. Every hook is an empty
+// inline function, so with this policy no instrumentation code is generated.
+// A custom policy derives from no_hooks and hides the hooks it is interested in.
+// Subjects call the notify and invoke hooks, and on_disconnect for the observers
+// they drop when destroyed; observer owners call on_connect and on_disconnect.
+struct no_hooks
+{
+    static void on_notify_begin( const void * /* subject */, std::size_t /* observers */ ) noexcept {}
+    static void on_notify_end( const void * /* subject */ ) noexcept {}
+    static void on_invoke_begin( const void * /* subject */, const observer_handle * /* observer */ ) noexcept {}
+    static void on_invoke_end( const void * /* subject */, const observer_handle * /* observer */ ) noexcept {}
+    static void on_connect( const void * /* owner */, const void * /* subject */, const observer_handle * /* observer */ ) noexcept {}
+    static void on_disconnect( const void * /* owner */, const observer_handle * /* observer */ ) noexcept {}
+};
+
 class observer_handle
 {
     template< typename ...A >
-    friend class subject;
-    friend class observer_owner;
-
-    observer_owner& m_owner;
+    friend class pg_detail::subject_base;
+    template< typename ...A >
+    friend class pg_detail::compact_subject_base;
+    template< typename ...A >
+    friend class pg_detail::observer_slots;
+    template< typename HOOKS, typename ...A >
+    friend class basic_subject;
+    template< typename HOOKS, typename ...A >
+    friend class basic_compact_subject;
+    template< typename HOOKS >
+    friend class basic_observer_owner;
+    friend class pg_detail::owner_base;
+    friend class scoped_connection;
 
     virtual void remove_from_subject() noexcept = 0;
 
-    void remove_from_owner() noexcept;
+    // Removes all observers of this handle's owner from the subject in one pass.
+    virtual void remove_owner_from_subject( void ( *removed )( observer_handle * ) noexcept ) noexcept = 0;
+
+    virtual void set_suspended( bool suspended ) noexcept = 0;
+
+    virtual void remove_from_owner() noexcept;
+
+protected:
+    pg_detail::owner_base& m_owner;
+    std::uint32_t          m_index = 0;    // The owner's slot of this handle.
+    std::uint32_t          m_slot  = 0;    // The subject's slot of this handle.
 
 public:
-    explicit observer_handle( observer_owner& owner ) noexcept
+    explicit observer_handle( pg_detail::owner_base& owner ) noexcept
             : m_owner( owner )
     {}
 
@@ -104,188 +194,1477 @@ public:
 namespace pg_detail
 {
 
-template< typename ...A >
-class abstract_observer : public observer_handle
+struct no_list_storage {};
+
+// What the handles of the observer list LIST keep for the list.
+template< typename LIST >
+struct list_storage
+{
+    using type = no_list_storage;
+};
+
+template< typename LIST >
+using list_storage_t = typename list_storage< LIST >::type;
+
+// The owner's record of an observer in the observer list LIST, which is
+// subject_base or compact_subject_base. The list itself keeps the callable.
+template< typename LIST >
+class list_observer final : public observer_handle, public list_storage_t< LIST >
 {
-    subject< A... > &m_subject;
+    LIST &m_subject;
 
-    virtual void remove_from_subject() noexcept final
+    virtual void remove_from_subject() noexcept override
     {
         m_subject.remove_observer( this );
     }
 
+    virtual void remove_owner_from_subject( void ( *removed )( observer_handle * ) noexcept ) noexcept override
+    {
+        m_subject.remove_owner( m_owner, removed );
+    }
+
+    virtual void set_suspended( bool suspended ) noexcept override
+    {
+        m_subject.suspend_observer( this, suspended );
+    }
+
 public:
-    explicit abstract_observer( observer_owner& owner, subject< A... > &s ) noexcept
+    explicit list_observer( owner_base& owner, LIST &s ) noexcept
             : observer_handle( owner )
             , m_subject( s )
     {}
+};
+
+template< typename I, typename F >
+struct member_call;
+
+template< typename I, typename R, typename ...Ao >
+struct member_call< I, R ( I::* )( Ao... ) >
+{
+    I *m_instance;
+    R ( I::*m_function )( Ao... );
 
-    virtual void notify( A... args ) = 0;
+    void operator()( Ao && ... args ) const
+    {
+        ( m_instance->*m_function )( std::forward< Ao >( args )... );
+    }
 };
 
+// The memory that calling an observer touches first, fetched ahead of the call.
+template< typename F >
+void * prefetch_target( const F & ) noexcept
+{
+    return nullptr;
+}
+
+inline void prefetch( const void *p ) noexcept
+{
+#if defined( __GNUC__ )
+    __builtin_prefetch( p );
+#else
+    ( void )p;
+#endif
+}
+
+template< typename F, typename ...A >
+void call_observer( F &f, A... args )
+{
+    std::apply( f, get_first_n< function_arity< F >{} >( std::forward< A >( args )... ) );
 }
 
+// The part of an observer that a notification reads, sized so that two slots
+// share a cache line: a call thunk, a context pointer that is prefetched ahead
+// of the call and room for a small callable. The context is the instance of a
+// member function observer, the heap block of a callable that is too large,
+// over-aligned or not trivially copyable to be stored in the slot, or null.
 template< typename ...A >
-class subject
+struct observer_slot
 {
-    friend class pg_detail::abstract_observer< A... >;
-    friend class subject_blocker< subject< A... > >;
+    static constexpr std::size_t storage_size = 2 * sizeof( void * );
 
-    std::vector< pg_detail::abstract_observer< A... > * > m_observers;
+    void ( *invoke )( const observer_slot &, A... );
+    void *context;
 
-    void remove_observer( observer_handle *o ) noexcept
+    alignas( void * ) mutable unsigned char storage[ storage_size ];
+};
+
+// The part of an observer that is only needed to disconnect it.
+struct observer_record
+{
+    void ( *destroy )( void * ) noexcept;    // Frees the slot's context; null when the slot does not own it.
+    observer_handle *handle;
+    void ( *resume )() = nullptr;            // The call thunk of a suspended slot.
+
+    void release( void *context ) const noexcept
     {
-        // Iterate reversed over the m_observers since we expect that observers that
-        // are frequently connected and disconnected resides at the end of the vector.
-        auto it_find = std::find_if( m_observers.rbegin(), m_observers.rend(), [o]( const auto &o1 )
-        {
-            return static_cast< observer_handle * >( o1 ) == o;
-        } );
-        if( it_find != m_observers.rend() )
+        if( destroy )
         {
-            m_observers.erase( ( ++it_find ).base() );
+            destroy( context );
         }
     }
+};
 
-public:
-    ~subject() noexcept
+// The only observer of a compact subject, which the subject keeps in the
+// observer's handle instead of allocating an array.
+template< typename ...A >
+struct inline_observer
+{
+    observer_slot< A... > hot;
+    observer_record       cold;
+};
+
+template< typename ...A >
+struct list_storage< compact_subject_base< A... > >
+{
+    using type = inline_observer< A... >;
+};
+
+template< typename F, typename ...A >
+struct slot_callable
+{
+    static constexpr bool in_place = sizeof( F ) <= observer_slot< A... >::storage_size &&
+                                     alignof( F ) <= alignof( void * ) &&
+                                     std::is_trivially_copyable_v< F >;
+
+    static F & get( const observer_slot< A... > &slot ) noexcept
     {
-        for( auto& o : m_observers )
+        if constexpr( in_place )
         {
-            o->remove_from_owner();
+            return *std::launder( reinterpret_cast< F * >( slot.storage ) );
+        }
+        else
+        {
+            return *static_cast< F * >( slot.context );
         }
     }
 
-    void notify( A... args ) const
+    static void invoke( const observer_slot< A... > &slot, A... args )
+    {
+        call_observer< F, A... >( get( slot ), std::forward< A >( args )... );
+    }
+
+    static void destroy( void *context ) noexcept
+    {
+        delete static_cast< F * >( context );
+    }
+
+    static observer_slot< A... > make( F f )
     {
-        for( auto& o : m_observers )
+        observer_slot< A... > slot = { &invoke, nullptr, {} };
+        if constexpr( in_place )
+        {
+            ::new( static_cast< void * >( slot.storage ) ) F( std::move( f ) );
+            slot.context = prefetch_target( get( slot ) );
+        }
+        else
         {
-            o->notify( args... );
+            slot.context = new F( std::move( f ) );
         }
+
+        return slot;
     }
 
-    void add_observer( pg_detail::abstract_observer< A... > *o ) noexcept
+    static observer_record record( observer_handle *handle ) noexcept
     {
-        m_observers.push_back( o );
+        return { in_place ? nullptr : &destroy, handle };
     }
 };
 
-class observer_owner
+// A member function observer keeps its instance in the context and the member
+// function pointer in the slot.
+template< typename I, typename M, typename ...A >
+struct slot_callable< member_call< I, M >, A... >
 {
-    friend class observer_handle;
+    static_assert( sizeof( M ) <= observer_slot< A... >::storage_size, "The member function pointer does not fit in an observer slot" );
 
-    struct observer_handle_ptr_comp
+    static void invoke( const observer_slot< A... > &slot, A... args )
     {
-        using is_transparent = std::true_type;
-        using handle_uptr    = std::unique_ptr< observer_handle >;
+        member_call< I, M > f = { static_cast< I * >( slot.context ), *std::launder( reinterpret_cast< M * >( slot.storage ) ) };
+        call_observer< member_call< I, M >, A... >( f, std::forward< A >( args )... );
+    }
 
-        bool operator()( const handle_uptr& lhs, const handle_uptr& rhs ) const noexcept { return lhs < rhs; }
-        bool operator()( const handle_uptr& lhs, observer_handle *rhs ) const noexcept { return lhs.get() < rhs; }
-        bool operator()( observer_handle *lhs, const handle_uptr& rhs ) const noexcept { return lhs < rhs.get(); }
-    };
+    static observer_slot< A... > make( member_call< I, M > f ) noexcept
+    {
+        observer_slot< A... > slot = { &invoke, f.m_instance, {} };
+        ::new( static_cast< void * >( slot.storage ) ) M( f.m_function );
 
-    std::set< std::unique_ptr< observer_handle >, observer_handle_ptr_comp > m_observers;
+        return slot;
+    }
 
-    void remove_observer( observer_handle *o ) noexcept
+    static observer_record record( observer_handle *handle ) noexcept
     {
-        auto it_find = m_observers.find( o );
-        m_observers.erase( it_find );
+        return { nullptr, handle };
     }
+};
+
+// The observers of a subject as two parallel arrays in one buffer; the slots
+// that notifications read, followed by the records that are only needed to
+// disconnect.
+template< typename ...A >
+class observer_slots
+{
+    using slot = observer_slot< A... >;
+
+    static_assert( alignof( slot ) >= alignof( observer_record ) && sizeof( slot ) % alignof( observer_record ) == 0 );
+
+    slot        *m_hot      = nullptr;
+    std::size_t  m_size     = 0;
+    std::size_t  m_capacity = 0;
+
+public:
+    observer_slots() noexcept = default;
+
+    observer_slots( observer_slots &&other ) noexcept
+            : m_hot( std::exchange( other.m_hot, nullptr ) )
+            , m_size( std::exchange( other.m_size, 0 ) )
+            , m_capacity( std::exchange( other.m_capacity, 0 ) )
+    {}
 
-    template< typename O, typename ...A >
-    observer_handle * connect( subject< A... > &s, std::unique_ptr< O > &&o ) noexcept
+    observer_slots & operator=( observer_slots &&other ) noexcept
     {
-        auto raw_o = o.get();
-        s.add_observer( raw_o );
+        std::swap( m_hot, other.m_hot );
+        std::swap( m_size, other.m_size );
+        std::swap( m_capacity, other.m_capacity );
 
-        m_observers.insert( std::move( o ) );
+        return *this;
+    }
 
-        return raw_o;
+    ~observer_slots() noexcept
+    {
+        ::operator delete( m_hot );
     }
 
-public:
-    ~observer_owner() noexcept
+    std::size_t size() const noexcept { return m_size; }
+    slot * hot() const noexcept { return m_hot; }
+    observer_record * cold() const noexcept { return reinterpret_cast< observer_record * >( m_hot + m_capacity ); }
+
+    void push_back( const slot &s, const observer_record &r )
     {
-        for( auto& o : m_observers )
+        if( m_size == m_capacity )
         {
-            o->remove_from_subject();
+            const auto capacity = m_capacity ? m_capacity * 2 : 4;
+            const auto hot      = static_cast< slot * >( ::operator new( capacity * ( sizeof( slot ) + sizeof( observer_record ) ) ) );
+            std::copy( m_hot, m_hot + m_size, hot );
+            std::copy( cold(), cold() + m_size, reinterpret_cast< observer_record * >( hot + capacity ) );
+            ::operator delete( m_hot );
+            m_hot      = hot;
+            m_capacity = capacity;
         }
+
+        m_hot[ m_size ]  = s;
+        cold()[ m_size ] = r;
+        r.handle->m_slot = static_cast< std::uint32_t >( m_size );
+        ++m_size;
     }
 
-    template< typename I, typename R, typename ...As, typename ...Ao >
-    observer_handle * connect( subject< As... > &s, I * instance, R ( I::*function )( Ao... ) ) noexcept
+    // Shifts the following observers down and updates their handles' slots.
+    static void erase( slot *hot, observer_record *cold, std::size_t size, std::size_t i ) noexcept
     {
-        using namespace pg_detail;
-
-        class observer final : public abstract_observer< As ... >
+        std::copy( hot + i + 1, hot + size, hot + i );
+        std::copy( cold + i + 1, cold + size, cold + i );
+        for( ; i < size - 1; ++i )
         {
-            I *           m_instance;
-            R( I::* const m_function )( Ao... );
+            cold[ i ].handle->m_slot = static_cast< std::uint32_t >( i );
+        }
+    }
 
-        public:
-            observer( observer_owner &owner, subject< As... > &s, I * const instance, R ( I::*f )( Ao... ) ) noexcept
-                    : abstract_observer< As... >( owner, s )
-                    , m_instance( instance )
-                    , m_function( f )
-            {}
+    void erase( std::size_t i ) noexcept
+    {
+        erase( m_hot, cold(), m_size, i );
+        --m_size;
+    }
 
-            void operator()( Ao && ... args )
+    // The context and record of the observers that remove_owner() took out.
+    using removed_list = std::vector< std::pair< void *, observer_record > >;
+
+    // Removes the observers of 'owner' from the arrays in one compacting pass,
+    // adds them to 'removed' and returns the new size. The caller commits the
+    // new size before it calls release(), so the callables' destructors see a
+    // consistent list when they disconnect other observers.
+    static std::size_t remove_owner( slot *hot, observer_record *cold, std::size_t size, const owner_base &owner, removed_list &removed ) noexcept
+    {
+        std::size_t n = 0;
+        for( std::size_t i = 0; i < size; ++i )
+        {
+            if( &cold[ i ].handle->m_owner == &owner )
             {
-                ( m_instance->*m_function )( std::forward< Ao >( args )... );
+                removed.emplace_back( hot[ i ].context, cold[ i ] );
             }
-
-            virtual void notify( As... args ) override
+            else
             {
-                std::apply( *this, get_first_n< sizeof...( Ao ) >( std::forward< As >( args )... ) );
+                hot[ n ]                 = hot[ i ];
+                cold[ n ]                = cold[ i ];
+                cold[ n ].handle->m_slot = static_cast< std::uint32_t >( n );
+                ++n;
             }
-        };
+        }
+
+        return n;
+    }
 
-        return connect( s, std::make_unique< observer >( *this, s, instance, function ) );
+    void remove_owner( const owner_base &owner, removed_list &removed ) noexcept
+    {
+        m_size = remove_owner( m_hot, cold(), m_size, owner, removed );
     }
 
-    template< typename F, typename ...As >
-    observer_handle * connect( subject< As... > &s, F function ) noexcept
+    // Calls removed( handle ) for the removed observers and then destroys their
+    // callables; their owner has dropped all of them by then.
+    static void release( const removed_list &removed_observers, void ( *removed )( observer_handle * ) noexcept ) noexcept
     {
-        using namespace pg_detail;
+        for( const auto &r : removed_observers )
+        {
+            removed( r.second.handle );
+        }
+        for( const auto &r : removed_observers )
+        {
+            r.second.release( r.first );
+        }
+    }
+
+    static void skip( const slot &, A... ) {}
 
-        class observer final : public abstract_observer< As... >
+    // A suspended slot calls skip() instead of the observer and keeps its call
+    // thunk in the record, so notify reads no more than for an active observer.
+    static void suspend( slot &s, observer_record &r, bool suspended ) noexcept
+    {
+        if( suspended && !r.resume )
+        {
+            r.resume = reinterpret_cast< void ( * )() >( s.invoke );
+            s.invoke = &skip;
+        }
+        else if( !suspended && r.resume )
         {
-            F m_function;
+            s.invoke = reinterpret_cast< void ( * )( const slot &, A... ) >( r.resume );
+            r.resume = nullptr;
+        }
+    }
+
+    // The handle knows its slot, so finding an observer takes no search. Returns
+    // size() when the observer is not in the list, e.g. while it is blocked.
+    std::size_t find( const observer_handle *o ) const noexcept
+    {
+        const std::size_t i = o->m_slot;
+
+        return i < m_size && cold()[ i ].handle == o ? i : m_size;
+    }
+};
 
-        public:
-            observer( observer_owner &owner, subject< As... > &s, F f ) noexcept
-                    : abstract_observer< As... >( owner, s )
-                    , m_function( f )
-            {}
+// The observer list of a subject, independent of the subject's hook policy so
+// that observers only depend on the notification values. The callables are
+// stored in the list, so a notification reads them in address order.
+template< typename ...A >
+class subject_base
+{
+    friend class list_observer< subject_base< A... > >;
+    friend class scoped_observer< subject_base< A... > >;
 
-            virtual void notify( As... args ) override
+    // The callable is destroyed after it left the list, so that its destructor
+    // may disconnect other observers from this subject.
+    void remove_observer( observer_handle *o ) noexcept
+    {
+        const auto i = m_observers.find( o );
+        if( i != m_observers.size() )
+        {
+            const auto context = m_observers.hot()[ i ].context;
+            const auto record  = m_observers.cold()[ i ];
+            m_observers.erase( i );
+#if defined( PG_OBSERVER_METERING )
+            if( m_meter )
             {
-                std::apply( m_function, get_first_n< function_arity< F >{} >( std::forward< As >( args )... ) );
+                m_meter->observer_removed();
             }
-        };
+#endif
+            record.release( context );
+        }
+    }
+
+    void suspend_observer( observer_handle *o, bool suspended ) noexcept
+    {
+        const auto i = m_observers.find( o );
+        if( i != m_observers.size() )
+        {
+            observer_slots< A... >::suspend( m_observers.hot()[ i ], m_observers.cold()[ i ], suspended );
+        }
+    }
+
+protected:
+    observer_slots< A... >           m_observers;
+#if defined( PG_OBSERVER_METERING )
+    std::unique_ptr< subject_meter > m_meter;    // Only instrumented subjects have a meter.
+#endif
+
+    subject_base() noexcept = default;
+
+    // A copy starts without observers; the observers stay with the original.
+    subject_base( const subject_base & ) noexcept
+            : subject_base()
+    {}
+
+    subject_base & operator=( const subject_base & ) noexcept
+    {
+        return *this;
+    }
+
+    // The observers are taken from the back, so that the destructor of a callable
+    // finds the observers that are left when it disconnects them.
+    ~subject_base() noexcept
+    {
+        while( const auto size = m_observers.size() )
+        {
+            const auto context = m_observers.hot()[ size - 1 ].context;
+            const auto record  = m_observers.cold()[ size - 1 ];
+            m_observers.erase( size - 1 );
+            record.handle->remove_from_owner();
+            record.release( context );
+        }
+    }
+
+public:
+    template< typename F >
+    void add_observer( observer_handle *o, F &&f )
+    {
+        using callable = slot_callable< std::decay_t< F >, A... >;
+
+        m_observers.push_back( callable::make( std::forward< F >( f ) ), callable::record( o ) );
+#if defined( PG_OBSERVER_METERING )
+        if( m_meter )
+        {
+            m_meter->observer_added();
+        }
+#endif
+    }
+
+    void remove_owner( const owner_base &owner, void ( *removed )( observer_handle * ) noexcept ) noexcept
+    {
+        typename observer_slots< A... >::removed_list removed_observers;
 
-        return connect( s, std::make_unique< observer >( *this, s, function ) );
+        m_observers.remove_owner( owner, removed_observers );
+#if defined( PG_OBSERVER_METERING )
+        if( m_meter )
+        {
+            m_meter->observer_removed( removed_observers.size() );
+        }
+#endif
+        observer_slots< A... >::release( removed_observers, removed );
     }
 
-    template< typename ...As1, typename ...As2 >
-    observer_handle * connect( subject< As1... > &s1, subject< As2... > &s2 ) noexcept
+#if defined( PG_OBSERVER_METERING )
+    // Names the subject's meter and registers it with the meter_registry. The
+    // meter is created here, so subjects that are never instrumented are not metered.
+    void instrument( std::string name )
     {
-        return connect( s1, [&]( As2 &&... args ){ s2.notify( std::forward< As2 >( args )... ); } );
+        if( !m_meter )
+        {
+            m_meter = std::make_unique< subject_meter >();
+            m_meter->observer_added( m_observers.size() );
+        }
+        m_meter->instrument( std::move( name ) );
     }
 
-    void disconnect( observer_handle *o ) noexcept
+    // Null until the subject is instrumented.
+    const subject_meter * meter() const noexcept
     {
-        o->remove_from_subject();
-        remove_observer( o );
+        return m_meter.get();
     }
+#endif
 };
 
+template< typename HOOKS >
+struct notify_scope
+{
+    const void *m_subject;
+
+    ~notify_scope() noexcept { HOOKS::on_notify_end( m_subject ); }
+};
 
-void observer_handle::remove_from_owner() noexcept
+template< typename HOOKS >
+struct invoke_scope
 {
-    m_owner.remove_observer( this );
+    const void            *m_subject;
+    const observer_handle *m_observer;
+
+    ~invoke_scope() noexcept { HOOKS::on_invoke_end( m_subject, m_observer ); }
+};
+
+// The record is only read when the hooks or the tracepoints use the handle.
+template< typename HOOKS, typename ...A >
+void invoke( const void *subject, const observer_slot< A... > &o, const observer_record &r, A &... args )
+{
+    PG_OBSERVER_PROBE2( invoke_entry, subject, static_cast< const void * >( r.handle ) );
+    HOOKS::on_invoke_begin( subject, r.handle );
+    {
+        const invoke_scope< HOOKS > invoke_scope = { subject, r.handle };
+
+        o.invoke( o, args... );
+    }
+    PG_OBSERVER_PROBE2( invoke_return, subject, static_cast< const void * >( r.handle ) );
+}
+
+// Calls the observers in [first, last) and prefetches the context of the
+// observers a few slots ahead, so their cache misses overlap with the calls.
+// Suspended observers are not called, so their context is not prefetched.
+template< typename HOOKS, typename ...A >
+void dispatch( const void *subject, const observer_slot< A... > *first, const observer_slot< A... > *last, const observer_record *records, A &... args )
+{
+    constexpr std::ptrdiff_t prefetch_distance = 2;
+
+    auto o = first;
+    for( ; last - o > prefetch_distance; ++o )
+    {
+        if( o[ prefetch_distance ].invoke != &observer_slots< A... >::skip )
+        {
+            prefetch( o[ prefetch_distance ].context );
+        }
+        invoke< HOOKS, A... >( subject, *o, records[ o - first ], args... );
+    }
+    for( ; o != last; ++o )
+    {
+        invoke< HOOKS, A... >( subject, *o, records[ o - first ], args... );
+    }
 }
 
+}
+
+template< typename HOOKS, typename ...A >
+class basic_subject : public pg_detail::subject_base< A... >
+{
+    friend class subject_blocker< basic_subject< HOOKS, A... > >;
+
+    using pg_detail::subject_base< A... >::m_observers;
+#if defined( PG_OBSERVER_METERING )
+    using pg_detail::subject_base< A... >::m_meter;
+#endif
+
+public:
+    ~basic_subject() noexcept
+    {
+        for( auto r = m_observers.cold(); r != m_observers.cold() + m_observers.size(); ++r )
+        {
+            HOOKS::on_disconnect( static_cast< const void * >( &r->handle->m_owner ), r->handle );
+        }
+    }
+
+    void notify( A... args ) const
+    {
+#if defined( PG_OBSERVER_METERING )
+        const auto start = m_meter ? m_meter->begin_notify( m_observers.size() ) : std::chrono::steady_clock::time_point();
+#endif
+        PG_OBSERVER_PROBE2( notify_entry, static_cast< const void * >( this ), m_observers.size() );
+        HOOKS::on_notify_begin( this, m_observers.size() );
+        {
+            const pg_detail::notify_scope< HOOKS > notify_scope = { this };
+
+            pg_detail::dispatch< HOOKS, A... >( this, m_observers.hot(), m_observers.hot() + m_observers.size(), m_observers.cold(), args... );
+        }
+        PG_OBSERVER_PROBE2( notify_return, static_cast< const void * >( this ), m_observers.size() );
+#if defined( PG_OBSERVER_METERING )
+        if( m_meter )
+        {
+            m_meter->end_notify( start );
+        }
+#endif
+    }
+};
+
+template< typename ...A >
+using subject = basic_subject< no_hooks, A... >;
+
+namespace pg_detail
+{
+
+// The observer list of a compact subject in a single tagged pointer: null without
+// observers, the inline_observer in the handle of a single observer, or a heap
+// array with the slots followed by the records, with the lowest bit set.
+template< typename ...A >
+class compact_subject_base
+{
+    friend class list_observer< compact_subject_base< A... > >;
+    friend class scoped_observer< compact_subject_base< A... > >;
+
+protected:
+    using slot = observer_slot< A... >;
+
+    // Followed by 'capacity' slots and 'capacity' records.
+    struct slot_array
+    {
+        std::size_t size;
+        std::size_t capacity;
+
+        slot * hot() noexcept { return reinterpret_cast< slot * >( this + 1 ); }
+        observer_record * cold() noexcept { return reinterpret_cast< observer_record * >( hot() + capacity ); }
+    };
+
+    static_assert( alignof( slot_array ) >= alignof( slot ) && sizeof( slot_array ) % alignof( slot ) == 0 );
+    static_assert( alignof( slot ) >= alignof( observer_record ) && sizeof( slot ) % alignof( observer_record ) == 0 );
+    static_assert( alignof( inline_observer< A... > ) > 1 && alignof( slot_array ) > 1 );
+
+    static constexpr std::uintptr_t array_tag = 1;
+
+private:
+    static slot_array * allocate( std::size_t capacity )
+    {
+        auto a      = static_cast< slot_array * >( ::operator new( sizeof( slot_array ) + capacity * ( sizeof( slot ) + sizeof( observer_record ) ) ) );
+        a->size     = 0;
+        a->capacity = capacity;
+
+        return a;
+    }
+
+    // Takes the observer at 'i' out of the list and returns its context and
+    // record. The array is kept until the last observer leaves, so a subject with
+    // observers coming and going does not allocate on every connect.
+    std::pair< void *, observer_record > erase( std::size_t i ) noexcept
+    {
+        slot            *hot;
+        observer_record *cold;
+        const auto      size = observers( hot, cold );
+
+        const std::pair< void *, observer_record > removed = { hot[ i ].context, cold[ i ] };
+
+        observer_slots< A... >::erase( hot, cold, size, i );
+        if( size == 1 )
+        {
+            if( m_observers & array_tag )
+            {
+                ::operator delete( array() );
+            }
+            m_observers = 0;
+        }
+        else
+        {
+            --array()->size;
+        }
+
+        return removed;
+    }
+
+    // Returns size() when the observer is not in the list.
+    std::size_t find( const observer_handle *o ) const noexcept
+    {
+        slot            *hot;
+        observer_record *cold;
+        const auto      size = observers( hot, cold );
+        const auto      i    = std::size_t( o->m_slot );
+
+        return i < size && cold[ i ].handle == o ? i : size;
+    }
+
+    // The callable is destroyed after it left the list, so that its destructor
+    // may disconnect other observers from this subject.
+    void remove_observer( observer_handle *o ) noexcept
+    {
+        const auto i = find( o );
+        if( i != observer_count() )
+        {
+            const auto removed = erase( i );
+            removed.second.release( removed.first );
+        }
+    }
+
+    void suspend_observer( observer_handle *o, bool suspended ) noexcept
+    {
+        slot            *hot;
+        observer_record *cold;
+        const auto      i = find( o );
+
+        if( i != observers( hot, cold ) )
+        {
+            observer_slots< A... >::suspend( hot[ i ], cold[ i ], suspended );
+        }
+    }
+
+protected:
+    std::uintptr_t m_observers = 0;
+
+    inline_observer< A... > * single() const noexcept { return reinterpret_cast< inline_observer< A... > * >( m_observers ); }
+    slot_array * array() const noexcept { return reinterpret_cast< slot_array * >( m_observers & ~array_tag ); }
+
+    // Points 'hot' and 'cold' at the slots and records and returns their number.
+    std::size_t observers( slot *&hot, observer_record *&cold ) const noexcept
+    {
+        if( m_observers & array_tag )
+        {
+            const auto a = array();
+            hot          = a->hot();
+            cold         = a->cold();
+            return a->size;
+        }
+
+        const auto s = single();
+        hot          = s ? &s->hot : nullptr;
+        cold         = s ? &s->cold : nullptr;
+        return s ? 1 : 0;
+    }
+
+    compact_subject_base() noexcept = default;
+
+    ~compact_subject_base() noexcept
+    {
+        while( const auto size = observer_count() )
+        {
+            const auto removed = erase( size - 1 );
+            removed.second.handle->remove_from_owner();
+            removed.second.release( removed.first );
+        }
+    }
+
+public:
+    compact_subject_base( const compact_subject_base & ) = delete;
+    compact_subject_base & operator=( const compact_subject_base & ) = delete;
+
+    // The first observer is kept in its handle, so a subject with a single
+    // observer does not allocate.
+    template< typename H, typename F >
+    void add_observer( H *o, F &&f )
+    {
+        using callable = slot_callable< std::decay_t< F >, A... >;
+
+        if( !m_observers )
+        {
+            inline_observer< A... > &s = *o;
+
+            s.hot       = callable::make( std::forward< F >( f ) );
+            s.cold      = callable::record( o );
+            o->m_slot   = 0;
+            m_observers = reinterpret_cast< std::uintptr_t >( &s );
+            return;
+        }
+
+        auto a = m_observers & array_tag ? array() : nullptr;
+        if( !a || a->size == a->capacity )
+        {
+            auto grown = allocate( a ? a->capacity * 2 : 2 );
+            if( a )
+            {
+                std::copy( a->hot(), a->hot() + a->size, grown->hot() );
+                std::copy( a->cold(), a->cold() + a->size, grown->cold() );
+                grown->size = a->size;
+                ::operator delete( a );
+            }
+            else
+            {
+                grown->hot()[ 0 ]  = single()->hot;
+                grown->cold()[ 0 ] = single()->cold;
+                grown->size        = 1;
+            }
+            a           = grown;
+            m_observers = reinterpret_cast< std::uintptr_t >( grown ) | array_tag;
+        }
+        a->hot()[ a->size ]  = callable::make( std::forward< F >( f ) );
+        a->cold()[ a->size ] = callable::record( o );
+        o->m_slot            = static_cast< std::uint32_t >( a->size );
+        ++a->size;
+    }
+
+    void remove_owner( const owner_base &owner, void ( *removed )( observer_handle * ) noexcept ) noexcept
+    {
+        slot            *hot;
+        observer_record *cold;
+        const auto      size = observers( hot, cold );
+
+        if( size )
+        {
+            typename observer_slots< A... >::removed_list removed_observers;
+
+            const auto n = observer_slots< A... >::remove_owner( hot, cold, size, owner, removed_observers );
+            if( n == 0 )
+            {
+                if( m_observers & array_tag )
+                {
+                    ::operator delete( array() );
+                }
+                m_observers = 0;
+            }
+            else if( n != size )
+            {
+                array()->size = n;
+            }
+
+            observer_slots< A... >::release( removed_observers, removed );
+        }
+    }
+
+    std::size_t observer_count() const noexcept
+    {
+        if( m_observers & array_tag )
+        {
+            return array()->size;
+        }
+
+        return m_observers ? 1 : 0;
+    }
+};
+
+}
+
+// A subject that takes the size of one pointer, for the many objects whose
+// subjects mostly have no observers. Notifying a subject without observers is a
+// single branch and calls none of the hooks. A single observer is kept in its
+// handle, so only a second observer allocates. Compact subjects are not metered.
+template< typename HOOKS, typename ...A >
+class basic_compact_subject : public pg_detail::compact_subject_base< A... >
+{
+    friend class subject_blocker< basic_compact_subject< HOOKS, A... > >;
+
+    using base = pg_detail::compact_subject_base< A... >;
+    using base::m_observers;
+
+public:
+    basic_compact_subject() noexcept = default;
+
+    ~basic_compact_subject() noexcept
+    {
+        typename base::slot        *hot;
+        pg_detail::observer_record *cold;
+        const auto                 size = base::observers( hot, cold );
+
+        for( auto r = cold; r != cold + size; ++r )
+        {
+            HOOKS::on_disconnect( static_cast< const void * >( &r->handle->m_owner ), r->handle );
+        }
+    }
+
+    void notify( A... args ) const
+    {
+        if( !m_observers )
+        {
+            return;
+        }
+
+        typename base::slot        *hot;
+        pg_detail::observer_record *cold;
+        const auto                 size = base::observers( hot, cold );
+
+        PG_OBSERVER_PROBE2( notify_entry, static_cast< const void * >( this ), size );
+        HOOKS::on_notify_begin( this, size );
+        {
+            const pg_detail::notify_scope< HOOKS > notify_scope = { this };
+
+            pg_detail::dispatch< HOOKS, A... >( this, hot, hot + size, cold, args... );
+        }
+        PG_OBSERVER_PROBE2( notify_return, static_cast< const void * >( this ), base::observer_count() );
+    }
+};
+
+template< typename ...A >
+using compact_subject = basic_compact_subject< no_hooks, A... >;
+
+namespace pg_detail
+{
+
+// Deduces the notification values of a subject or of a class derived from one.
+template< typename ...A >
+std::tuple< A... > subject_arguments( const subject_base< A... > & );
+
+template< typename ...A >
+std::tuple< A... > subject_arguments( const compact_subject_base< A... > & );
+
+template< typename S >
+using subject_arguments_t = decltype( subject_arguments( std::declval< S & >() ) );
+
+// Deduces the observer list that a subject's observers remove themselves from.
+template< typename ...A >
+subject_base< A... > & observer_list( subject_base< A... > & );
+
+template< typename ...A >
+compact_subject_base< A... > & observer_list( compact_subject_base< A... > & );
+
+template< typename S >
+using observer_list_t = std::remove_reference_t< decltype( observer_list( std::declval< S & >() ) ) >;
+
+template< typename S, typename = void >
+struct is_subject : std::false_type {};
+
+template< typename S >
+struct is_subject< S, std::void_t< subject_arguments_t< S > > > : std::true_type {};
+
+template< typename S >
+constexpr bool is_subject_v = is_subject< S >::value;
+
+// Callable that passes the notification on to another subject.
+template< typename S, typename ARGS = subject_arguments_t< S > >
+struct subject_forwarder;
+
+template< typename S, typename ...As >
+struct subject_forwarder< S, std::tuple< As... > >
+{
+    S &m_subject;
+
+    void operator()( As && ... args ) const
+    {
+        m_subject.notify( std::forward< As >( args )... );
+    }
+};
+
+template< typename S >
+void * prefetch_target( const subject_forwarder< S > &f ) noexcept
+{
+    return &f.m_subject;
+}
+
+}
+
+namespace pg_detail
+{
+
+// The observers of an owner, independent of the owner's hook policy so that
+// observer handles can remove themselves from any owner. The handles are kept
+// in a slot map; a connection is the index of the handle's slot and the slot's
+// generation, which changes when the handle is removed.
+class owner_base
+{
+    friend class pg::observer_handle;
+
+    static constexpr std::uint32_t no_slot = ~std::uint32_t( 0 );
+
+    struct slot
+    {
+        std::unique_ptr< observer_handle > handle;
+        std::uint32_t                      generation = 1;
+        std::uint32_t                      next_free  = no_slot;
+    };
+
+    std::uint32_t m_free = no_slot;
+
+protected:
+    std::vector< slot > m_observers;
+
+    owner_base() noexcept = default;
+    ~owner_base() noexcept = default;
+
+    connection insert( std::unique_ptr< observer_handle > o )
+    {
+        auto index = m_free;
+        if( index == no_slot )
+        {
+            index = static_cast< std::uint32_t >( m_observers.size() );
+            m_observers.emplace_back();
+        }
+        else
+        {
+            m_free = m_observers[ index ].next_free;
+        }
+
+        auto &s    = m_observers[ index ];
+        o->m_index = index;
+        s.handle   = std::move( o );
+
+        return { index, s.generation };
+    }
+
+    observer_handle * find( connection c ) const noexcept
+    {
+        return c.index < m_observers.size() && m_observers[ c.index ].generation == c.generation ? m_observers[ c.index ].handle.get() : nullptr;
+    }
+
+    void remove_observer( observer_handle *o ) noexcept
+    {
+        const auto index = o->m_index;
+        auto &s          = m_observers[ index ];
+
+        s.handle.reset();
+        if( ++s.generation == 0 )
+        {
+            s.generation = 1;    // A default constructed connection never matches.
+        }
+        s.next_free = m_free;
+        m_free      = index;
+    }
+};
+
+}
+
+template< typename HOOKS >
+class basic_observer_owner : public pg_detail::owner_base
+{
+    template< typename S, typename F >
+    connection add_observer( S &s, F &&f )
+    {
+        auto o       = std::make_unique< pg_detail::list_observer< pg_detail::observer_list_t< S > > >( *this, s );
+        auto raw_o   = o.get();
+        const auto c = insert( std::move( o ) );
+
+        // A replay_subject calls the observer before it is added; when that throws
+        // the subject is unchanged and only the owner's slot must be undone.
+        try
+        {
+            s.add_observer( raw_o, std::forward< F >( f ) );
+        }
+        catch( ... )
+        {
+            remove_observer( raw_o );
+            throw;
+        }
+
+        PG_OBSERVER_PROBE3( connect, static_cast< const void * >( this ), static_cast< const void * >( &s ), static_cast< const void * >( raw_o ) );
+        HOOKS::on_connect( this, &s, raw_o );
+
+        return c;
+    }
+
+    static void disconnected( observer_handle *o ) noexcept
+    {
+        auto &owner = static_cast< basic_observer_owner & >( o->m_owner );
+
+        PG_OBSERVER_PROBE2( disconnect, static_cast< const void * >( &owner ), static_cast< const void * >( o ) );
+        HOOKS::on_disconnect( &owner, o );
+
+        owner.remove_observer( o );
+    }
+
+public:
+    // Removes the observers per subject in one pass over the subject's observers,
+    // instead of searching each of them separately.
+    ~basic_observer_owner() noexcept
+    {
+        for( auto &s : m_observers )
+        {
+            if( const auto o = s.handle.get() )
+            {
+                o->remove_owner_from_subject( &disconnected );
+
+                // Not found when the subject is blocked.
+                if( s.handle.get() == o )
+                {
+                    disconnected( o );
+                }
+            }
+        }
+    }
+
+    template< typename S, typename I, typename R, typename ...Ao >
+    std::enable_if_t< pg_detail::is_subject_v< S >, connection > connect( S &s, I * instance, R ( I::*function )( Ao... ) )
+    {
+        return add_observer( s, pg_detail::member_call< I, R ( I::* )( Ao... ) >{ instance, function } );
+    }
+
+    template< typename S, typename F >
+    std::enable_if_t< pg_detail::is_subject_v< S > && !pg_detail::is_subject_v< F >, connection > connect( S &s, F function )
+    {
+        return add_observer( s, std::move( function ) );
+    }
+
+    template< typename S1, typename S2 >
+    std::enable_if_t< pg_detail::is_subject_v< S1 > && pg_detail::is_subject_v< S2 >, connection > connect( S1 &s1, S2 &s2 )
+    {
+        return connect( s1, pg_detail::subject_forwarder< S2 >{ s2 } );
+    }
+
+    // The handle that the hooks receive for the connection, or null when the
+    // connection is gone.
+    const observer_handle * handle( connection c ) const noexcept
+    {
+        return find( c );
+    }
+
+    // Skips the observer in notifications until it is resumed, without
+    // disconnecting it.
+    void suspend( connection c ) noexcept
+    {
+        if( const auto o = find( c ) )
+        {
+            o->set_suspended( true );
+        }
+    }
+
+    void resume( connection c ) noexcept
+    {
+        if( const auto o = find( c ) )
+        {
+            o->set_suspended( false );
+        }
+    }
+
+    void disconnect( connection c ) noexcept
+    {
+        if( const auto o = find( c ) )
+        {
+            PG_OBSERVER_PROBE2( disconnect, static_cast< const void * >( this ), static_cast< const void * >( o ) );
+            HOOKS::on_disconnect( this, o );
+
+            o->remove_from_subject();
+            remove_observer( o );
+        }
+    }
+
+    // Disconnects all observers of this owner from the subject.
+    template< typename S >
+    std::enable_if_t< pg_detail::is_subject_v< S > > disconnect_all( S &s ) noexcept
+    {
+        static_cast< pg_detail::observer_list_t< S > & >( s ).remove_owner( *this, &disconnected );
+    }
+};
+
+using observer_owner = basic_observer_owner< no_hooks >;
+
+
+inline void observer_handle::remove_from_owner() noexcept
+{
+    m_owner.remove_observer( this );
+}
+
+
+namespace pg_detail
+{
+
+// The owner that handles of scoped connections refer to; it never holds handles.
+inline owner_base & detached_owner() noexcept
+{
+    struct detached : owner_base {};
+
+    static detached owner;
+    return owner;
+}
+
+class scoped_handle : public observer_handle
+{
+    friend class pg::scoped_connection;
+
+    scoped_handle **m_link;    // The pointer of the scoped connection to this handle.
+
+    virtual void remove_from_owner() noexcept override
+    {
+        *m_link = nullptr;
+        delete this;
+    }
+
+    // Scoped connections are not part of an owner's teardown.
+    virtual void remove_owner_from_subject( void ( * )( observer_handle * ) noexcept ) noexcept override {}
+
+protected:
+    explicit scoped_handle( scoped_handle **link ) noexcept
+            : observer_handle( detached_owner() )
+            , m_link( link )
+    {}
+};
+
+template< typename LIST >
+class scoped_observer final : public scoped_handle, public list_storage_t< LIST >
+{
+    LIST &m_subject;
+
+    virtual void remove_from_subject() noexcept override
+    {
+        m_subject.remove_observer( this );
+    }
+
+    virtual void set_suspended( bool suspended ) noexcept override
+    {
+        m_subject.suspend_observer( this, suspended );
+    }
+
+public:
+    scoped_observer( LIST &s, scoped_handle **link ) noexcept
+            : scoped_handle( link )
+            , m_subject( s )
+    {}
+};
+
+}
+
+// A connection without an observer owner that disconnects when it is destroyed,
+// so the observer follows the lifetime of the object that holds it. It holds the
+// observer's handle, which knows the observer's slot in the subject, so
+// disconnecting does not search the subject. When the subject is destroyed first
+// the connection becomes empty.
+class scoped_connection
+{
+    pg_detail::scoped_handle *m_handle = nullptr;
+
+    template< typename S, typename F >
+    void connect( S &s, F &&f )
+    {
+        auto o = std::make_unique< pg_detail::scoped_observer< pg_detail::observer_list_t< S > > >( s, &m_handle );
+        s.add_observer( o.get(), std::forward< F >( f ) );
+        m_handle = o.release();
+
+        PG_OBSERVER_PROBE3( connect, static_cast< const void * >( nullptr ), static_cast< const void * >( &s ), static_cast< const void * >( m_handle ) );
+    }
+
+public:
+    scoped_connection() noexcept = default;
+
+    template< typename S, typename F, typename = std::enable_if_t< pg_detail::is_subject_v< S > && !pg_detail::is_subject_v< F > > >
+    scoped_connection( S &s, F function )
+    {
+        connect( s, std::move( function ) );
+    }
+
+    template< typename S, typename I, typename R, typename ...Ao, typename = std::enable_if_t< pg_detail::is_subject_v< S > > >
+    scoped_connection( S &s, I *instance, R ( I::*function )( Ao... ) )
+    {
+        connect( s, pg_detail::member_call< I, R ( I::* )( Ao... ) >{ instance, function } );
+    }
+
+    template< typename S1, typename S2, typename = std::enable_if_t< pg_detail::is_subject_v< S1 > && pg_detail::is_subject_v< S2 > > >
+    scoped_connection( S1 &s1, S2 &s2 )
+    {
+        connect( s1, pg_detail::subject_forwarder< S2 >{ s2 } );
+    }
+
+    scoped_connection( scoped_connection &&other ) noexcept
+            : m_handle( std::exchange( other.m_handle, nullptr ) )
+    {
+        if( m_handle )
+        {
+            m_handle->m_link = &m_handle;
+        }
+    }
+
+    scoped_connection & operator=( scoped_connection &&other ) noexcept
+    {
+        if( this != &other )
+        {
+            disconnect();
+            m_handle = std::exchange( other.m_handle, nullptr );
+            if( m_handle )
+            {
+                m_handle->m_link = &m_handle;
+            }
+        }
+
+        return *this;
+    }
+
+    ~scoped_connection() noexcept
+    {
+        disconnect();
+    }
+
+    void disconnect() noexcept
+    {
+        if( m_handle )
+        {
+            PG_OBSERVER_PROBE2( disconnect, static_cast< const void * >( nullptr ), static_cast< const void * >( m_handle ) );
+
+            m_handle->remove_from_subject();
+            delete std::exchange( m_handle, nullptr );
+        }
+    }
+
+    void suspend() noexcept
+    {
+        if( m_handle )
+        {
+            m_handle->set_suspended( true );
+        }
+    }
+
+    void resume() noexcept
+    {
+        if( m_handle )
+        {
+            m_handle->set_suspended( false );
+        }
+    }
+
+    bool connected() const noexcept
+    {
+        return m_handle != nullptr;
+    }
+};
+
+
+// A subject that remembers its last N notifications and replays them, oldest
+// first, to every observer that gets connected to it. The history is a fixed
+// size ring, so notify does not allocate beyond what copying the values needs.
+// The history is recorded by an observer that the subject connects to itself
+// first, so notifications through a reference to the base subject are recorded
+// too, and the observer counts of the subject include it. When an observer
+// throws during the replay, the exception propagates out of connect and the
+// observer is not connected.
+template< std::size_t N, typename ...A >
+class replay_subject : public subject< A... >
+{
+    static_assert( N > 0, "A replay subject must remember at least one notification" );
+
+    std::array< std::tuple< std::decay_t< A >... >, N > m_history;
+    std::size_t                                        m_next = 0;
+    std::size_t                                        m_size = 0;
+    scoped_connection                                  m_recorder;
+
+    void record( const std::decay_t< A > &... args )
+    {
+        m_history[ m_next ] = std::forward_as_tuple( args... );
+        m_next              = ( m_next + 1 ) % N;
+        m_size              = std::min( m_size + 1, N );
+    }
+
+    void connect_recorder()
+    {
+        m_recorder = scoped_connection( *this, [ this ]( const std::decay_t< A > &... args ){ record( args... ); } );
+    }
+
+public:
+    replay_subject()
+    {
+        connect_recorder();
+    }
+
+    // The copy has no observers besides its own recorder, like a copied subject,
+    // but it keeps the history.
+    replay_subject( const replay_subject &other )
+            : subject< A... >( other )
+    {
+        connect_recorder();
+
+        m_history = other.m_history;
+        m_next    = other.m_next;
+        m_size    = other.m_size;
+    }
+
+    replay_subject & operator=( const replay_subject &other )
+    {
+        m_history = other.m_history;
+        m_next    = other.m_next;
+        m_size    = other.m_size;
+
+        return *this;
+    }
+
+    template< typename F >
+    void add_observer( observer_handle *o, F &&f )
+    {
+        for( std::size_t i = ( m_next + N - m_size ) % N, n = m_size; n > 0; i = ( i + 1 ) % N, --n )
+        {
+            std::apply( [ &f ]( auto &... v ){ pg_detail::call_observer< std::decay_t< F >, A... >( f, v... ); }, m_history[ i ] );
+        }
+
+        subject< A... >::add_observer( o, std::forward< F >( f ) );
+    }
+
+    std::size_t history_size() const noexcept { return m_size; }
+
+    void clear_history() noexcept
+    {
+        m_size = 0;
+    }
+};
+
+namespace pg_detail
+{
+
+// The connections that a connection group made in one epoch. Their observers
+// are only called while the epoch is valid, and the epoch is only destroyed
+// while none of them runs.
+struct group_epoch
+{
+    observer_owner owner;
+    bool           valid   = true;
+    std::uint32_t  running = 0;
+};
+
+// Calls F only while its epoch is valid. It takes one pointer next to F, so
+// a callable of up to one pointer still fits in the observer slot.
+template< typename F >
+struct group_call
+{
+    group_epoch *m_epoch;
+    F           m_function;
+
+    struct running_scope
+    {
+        group_epoch *m_epoch;
+
+        ~running_scope() noexcept { --m_epoch->running; }
+    };
+
+    template< typename ...A >
+    void operator()( A && ... args )
+    {
+        if( m_epoch->valid )
+        {
+            ++m_epoch->running;
+            const running_scope scope = { m_epoch };
+
+            m_function( std::forward< A >( args )... );
+        }
+    }
+};
+
+template< typename F >
+struct function_arity< group_call< F > > : function_arity< F > {};
+
+}
+
+// Connections that are dropped together, e.g. the observers of a view that gets
+// hidden. invalidate() only marks the group's current epoch as invalid; notify
+// skips its observers right away, and they are disconnected later, per subject
+// in one pass, by reclaim(), the next invalidate() or the group's destruction.
+// An epoch with an observer that is running, e.g. one that invalidated its own
+// group, is kept until a reclaim after that observer returned. Reclaiming
+// changes the subjects' observer lists, so it must not happen while one of
+// them notifies.
+class connection_group
+{
+    std::unique_ptr< pg_detail::group_epoch >                m_epoch;
+    std::vector< std::unique_ptr< pg_detail::group_epoch > > m_retired;
+
+    template< typename S, typename F >
+    void add_observer( S &s, F &&f )
+    {
+        if( !m_epoch )
+        {
+            m_epoch = std::make_unique< pg_detail::group_epoch >();
+        }
+
+        m_epoch->owner.connect( s, pg_detail::group_call< std::decay_t< F > >{ m_epoch.get(), std::forward< F >( f ) } );
+    }
+
+public:
+    connection_group() noexcept = default;
+    connection_group( const connection_group & ) = delete;
+    connection_group & operator=( const connection_group & ) = delete;
+
+    template< typename S, typename I, typename R, typename ...Ao >
+    std::enable_if_t< pg_detail::is_subject_v< S > > connect( S &s, I * instance, R ( I::*function )( Ao... ) )
+    {
+        add_observer( s, pg_detail::member_call< I, R ( I::* )( Ao... ) >{ instance, function } );
+    }
+
+    template< typename S, typename F >
+    std::enable_if_t< pg_detail::is_subject_v< S > && !pg_detail::is_subject_v< F > > connect( S &s, F function )
+    {
+        add_observer( s, std::move( function ) );
+    }
+
+    template< typename S1, typename S2 >
+    std::enable_if_t< pg_detail::is_subject_v< S1 > && pg_detail::is_subject_v< S2 > > connect( S1 &s1, S2 &s2 )
+    {
+        add_observer( s1, pg_detail::subject_forwarder< S2 >{ s2 } );
+    }
+
+    // Drops all connections of the group without touching their subjects. The
+    // connections of earlier invalidations are disconnected first; the ones that
+    // are dropped now stay connected until a later reclaim, so notify may still
+    // be iterating over them.
+    void invalidate()
+    {
+        reclaim();
+        if( m_epoch )
+        {
+            m_epoch->valid = false;
+            m_retired.push_back( std::move( m_epoch ) );
+        }
+    }
+
+    // Disconnects the observers that were dropped by invalidate(), except those
+    // of an epoch with an observer that is running.
+    void reclaim()
+    {
+        // Taken out first, so that the observers' destructors may use the group.
+        std::vector< std::unique_ptr< pg_detail::group_epoch > > reclaimed;
+        reclaimed.swap( m_retired );
+        for( auto &e : reclaimed )
+        {
+            if( e->running )
+            {
+                m_retired.push_back( std::move( e ) );
+            }
+        }
+    }
+};
+
 
 template< typename S >
 class subject_blocker
@@ -296,6 +1675,7 @@ class subject_blocker
 public:
     subject_blocker( S &subject ) noexcept
             : m_subject( subject )
+            , m_observers()
     {
         std::swap( m_observers, m_subject.m_observers );
     }
@@ -0,0 +1,1596 @@
+#include "observer.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined( __linux__ )
+#include <linux/futex.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+using namespace pg;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//                          Hardware perf counters                           //
+///////////////////////////////////////////////////////////////////////////////
+
+enum counter_id
+{
+    cycles,
+    instructions,
+    branch_misses,
+    l1d_misses,
+    llc_misses,
+    counter_count
+};
+
+static const char *counter_names[ counter_count ] = { "cycles", "instructions", "branch_misses", "l1d_misses", "llc_misses" };
+
+using counter_values = std::array< double, counter_count >;
+
+// Reads the hardware counters of the process with perf_event_open. The counters
+// are opened by the main thread and inherited by the threads it starts, so the
+// ping_pong and scaling benchmarks count the work of all of their threads. Each
+// counter is opened on its own, so a counter the CPU or the container does not
+// expose is reported as unavailable (NaN) while the others keep working.
+class perf_counters
+{
+    std::array< int, counter_count >                            m_fds;
+    std::array< std::array< std::uint64_t, 3 >, counter_count > m_start = {};    // Count, time enabled and time running at start().
+
+    // Reads the count, the time enabled and the time running of counter 'i'.
+    bool read_counter( int i, std::array< std::uint64_t, 3 > &data ) const noexcept
+    {
+#if defined( __linux__ )
+        return read( m_fds[ i ], data.data(), sizeof( data ) ) == static_cast< ssize_t >( sizeof( data ) );
+#else
+        ( void )i;
+        ( void )data;
+        return false;
+#endif
+    }
+
+public:
+    perf_counters() noexcept
+    {
+        m_fds.fill( -1 );
+#if defined( __linux__ )
+        const auto cache = []( std::uint64_t id, std::uint64_t result )
+        {
+            return id | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( result << 16 );
+        };
+
+        const std::pair< std::uint32_t, std::uint64_t > events[ counter_count ] =
+        {
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+            { PERF_TYPE_HW_CACHE, cache( PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_RESULT_MISS ) },
+            { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES }
+        };
+
+        for( int i = 0; i < counter_count; ++i )
+        {
+            perf_event_attr attr;
+            std::memset( &attr, 0, sizeof( attr ) );
+            attr.size           = sizeof( attr );
+            attr.type           = events[ i ].first;
+            attr.config         = events[ i ].second;
+            attr.disabled       = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv     = 1;
+            attr.inherit        = 1;
+            attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            m_fds[ i ] = static_cast< int >( syscall( SYS_perf_event_open, &attr, 0, -1, -1, 0 ) );
+        }
+#endif
+    }
+
+    ~perf_counters() noexcept
+    {
+#if defined( __linux__ )
+        for( int fd : m_fds )
+        {
+            if( fd >= 0 )
+            {
+                close( fd );
+            }
+        }
+#endif
+    }
+
+    perf_counters( const perf_counters & )             = delete;
+    perf_counters & operator=( const perf_counters & ) = delete;
+
+    bool available() const noexcept
+    {
+        for( int fd : m_fds )
+        {
+            if( fd >= 0 )
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // PERF_EVENT_IOC_RESET does not clear the counts that exited threads added
+    // to an inherited counter, so a measurement is the difference between the
+    // values read at start() and at stop().
+    void start() noexcept
+    {
+#if defined( __linux__ )
+        for( int i = 0; i < counter_count; ++i )
+        {
+            if( m_fds[ i ] >= 0 )
+            {
+                if( !read_counter( i, m_start[ i ] ) )
+                {
+                    m_start[ i ].fill( 0 );
+                }
+                ioctl( m_fds[ i ], PERF_EVENT_IOC_ENABLE, 0 );
+            }
+        }
+#endif
+    }
+
+    // Counts are scaled up when the kernel multiplexed a counter.
+    counter_values stop() noexcept
+    {
+        counter_values values;
+        values.fill( NAN );
+#if defined( __linux__ )
+        for( int i = 0; i < counter_count; ++i )
+        {
+            const int fd = m_fds[ i ];
+            if( fd < 0 )
+            {
+                continue;
+            }
+
+            ioctl( fd, PERF_EVENT_IOC_DISABLE, 0 );
+
+            std::array< std::uint64_t, 3 > data;
+            if( read_counter( i, data ) )
+            {
+                const auto count   = data[ 0 ] - m_start[ i ][ 0 ];
+                const auto enabled = data[ 1 ] - m_start[ i ][ 1 ];
+                const auto running = data[ 2 ] - m_start[ i ][ 2 ];
+                if( running != 0 )
+                {
+                    values[ i ] = static_cast< double >( count ) * static_cast< double >( enabled ) / static_cast< double >( running );
+                }
+            }
+        }
+#endif
+        return values;
+    }
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+//                                  Harness                                  //
+///////////////////////////////////////////////////////////////////////////////
+
+struct latency_percentiles
+{
+    double p50;
+    double p99;
+    double p999;
+};
+
+// The measurements of one benchmark, one entry per repetition. Latencies are
+// only recorded by benchmarks that time individual operations.
+struct result
+{
+    std::string                        name;
+    std::vector< double >              ns_per_op;
+    std::vector< counter_values >      per_op;
+    std::vector< latency_percentiles > latency;
+};
+
+static perf_counters              counters;
+static std::vector< result >      results;
+static std::vector< std::string > notes;
+static const char                 *filter      = nullptr;
+static int                        repetitions = 5;
+
+static volatile std::uint64_t sink = 0;
+
+static bool selected( const std::string &name )
+{
+    return !filter || name.find( filter ) != std::string::npos;
+}
+
+static latency_percentiles percentiles( std::vector< double > &samples )
+{
+    if( samples.empty() )
+    {
+        return { NAN, NAN, NAN };
+    }
+
+    std::sort( samples.begin(), samples.end() );
+    const auto at = [ &samples ]( double q ){ return samples[ std::min( samples.size() - 1, static_cast< std::size_t >( q * static_cast< double >( samples.size() ) ) ) ]; };
+
+    return { at( 0.50 ), at( 0.99 ), at( 0.999 ) };
+}
+
+// Runs 'run' once to warm up and then measures it 'repetitions' times, each
+// time after 'setup' which is not measured; 'run' performs 'ops' operations.
+// A 'run' that accepts a std::vector< double > & records the latencies of
+// individual operations in it, in nanoseconds.
+template< typename SETUP, typename RUN >
+static void measure( const std::string &name, std::uint64_t ops, SETUP &&setup, RUN &&run )
+{
+    constexpr bool timed = std::is_invocable_v< RUN &, std::vector< double > & >;
+
+    std::vector< double > latencies;
+    const auto invoke = [ & ]
+    {
+        if constexpr( timed )
+        {
+            latencies.clear();
+            run( latencies );
+        }
+        else
+        {
+            run();
+        }
+    };
+
+    setup();
+    invoke();
+
+    result r = { name, {}, {}, {} };
+    for( int i = 0; i < repetitions; ++i )
+    {
+        setup();
+
+        const auto start = std::chrono::steady_clock::now();
+        counters.start();
+        invoke();
+        auto       values = counters.stop();
+        const auto end    = std::chrono::steady_clock::now();
+
+        for( auto &v : values )
+        {
+            v /= static_cast< double >( ops );
+        }
+
+        r.ns_per_op.push_back( std::chrono::duration< double, std::nano >( end - start ).count() / static_cast< double >( ops ) );
+        r.per_op.push_back( values );
+        if( timed )
+        {
+            r.latency.push_back( percentiles( latencies ) );
+        }
+    }
+    results.push_back( std::move( r ) );
+}
+
+template< typename RUN >
+static void measure( const std::string &name, std::uint64_t ops, RUN &&run )
+{
+    measure( name, ops, []{}, std::forward< RUN >( run ) );
+}
+
+static double median( std::vector< double > values )
+{
+    if( values.empty() )
+    {
+        return NAN;
+    }
+
+    std::sort( values.begin(), values.end() );
+    const auto n = values.size();
+
+    return n % 2 ? values[ n / 2 ] : ( values[ n / 2 - 1 ] + values[ n / 2 ] ) / 2.0;
+}
+
+static void print_results()
+{
+    std::printf( "%-48s %10s", "benchmark", "ns/op" );
+    for( auto name : counter_names )
+    {
+        std::printf( " %14s", name );
+    }
+    std::printf( "\n" );
+
+    for( const auto &r : results )
+    {
+        std::printf( "%-48s %10.2f", r.name.c_str(), median( r.ns_per_op ) );
+        for( int c = 0; c < counter_count; ++c )
+        {
+            std::vector< double > values;
+            for( const auto &v : r.per_op )
+            {
+                values.push_back( v[ c ] );
+            }
+
+            const auto v = median( values );
+            if( std::isnan( v ) )
+            {
+                std::printf( " %14s", "-" );
+            }
+            else
+            {
+                std::printf( " %14.2f", v );
+            }
+        }
+        std::printf( "\n" );
+    }
+
+    bool header = false;
+    for( const auto &r : results )
+    {
+        if( r.latency.empty() )
+        {
+            continue;
+        }
+
+        if( !header )
+        {
+            std::printf( "\n%-48s %14s %12s %12s %12s\n", "benchmark", "ops/s", "p50 ns", "p99 ns", "p99.9 ns" );
+            header = true;
+        }
+
+        std::vector< double > p50, p99, p999;
+        for( const auto &l : r.latency )
+        {
+            p50.push_back( l.p50 );
+            p99.push_back( l.p99 );
+            p999.push_back( l.p999 );
+        }
+        std::printf( "%-48s %14.0f %12.0f %12.0f %12.0f\n", r.name.c_str(), 1e9 / median( r.ns_per_op ), median( p50 ), median( p99 ), median( p999 ) );
+    }
+
+    if( !notes.empty() )
+    {
+        std::printf( "\n" );
+    }
+    for( const auto &note : notes )
+    {
+        std::printf( "%s\n", note.c_str() );
+    }
+}
+
+static void write_number( std::FILE *f, double v )
+{
+    if( std::isnan( v ) )
+    {
+        std::fprintf( f, "null" );
+    }
+    else
+    {
+        std::fprintf( f, "%.17g", v );
+    }
+}
+
+// Writes every repetition, so observer_benchmark_compare can judge the noise.
+static bool write_json( const char *path )
+{
+    auto f = std::fopen( path, "wb" );
+    if( !f )
+    {
+        return false;
+    }
+
+    std::fprintf( f, "{\n  \"repetitions\": %d,\n  \"benchmarks\": [", repetitions );
+    for( std::size_t i = 0; i < results.size(); ++i )
+    {
+        const auto &r = results[ i ];
+
+        std::fprintf( f, "%s\n    {\n      \"name\": \"%s\",\n      \"ns_per_op\": [", i ? "," : "", r.name.c_str() );
+        for( std::size_t j = 0; j < r.ns_per_op.size(); ++j )
+        {
+            std::fprintf( f, "%s", j ? ", " : "" );
+            write_number( f, r.ns_per_op[ j ] );
+        }
+        std::fprintf( f, "]" );
+
+        for( int c = 0; c < counter_count; ++c )
+        {
+            std::fprintf( f, ",\n      \"%s\": [", counter_names[ c ] );
+            for( std::size_t j = 0; j < r.per_op.size(); ++j )
+            {
+                std::fprintf( f, "%s", j ? ", " : "" );
+                write_number( f, r.per_op[ j ][ c ] );
+            }
+            std::fprintf( f, "]" );
+        }
+
+        if( !r.latency.empty() )
+        {
+            const std::pair< const char *, double latency_percentiles::* > fields[] =
+            {
+                { "p50_ns", &latency_percentiles::p50 },
+                { "p99_ns", &latency_percentiles::p99 },
+                { "p999_ns", &latency_percentiles::p999 }
+            };
+            for( const auto &field : fields )
+            {
+                std::fprintf( f, ",\n      \"%s\": [", field.first );
+                for( std::size_t j = 0; j < r.latency.size(); ++j )
+                {
+                    std::fprintf( f, "%s", j ? ", " : "" );
+                    write_number( f, r.latency[ j ].*field.second );
+                }
+                std::fprintf( f, "]" );
+            }
+        }
+        std::fprintf( f, "\n    }" );
+    }
+    std::fprintf( f, "\n  ]\n}\n" );
+
+    return std::fclose( f ) == 0;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+//                                Benchmarks                                 //
+///////////////////////////////////////////////////////////////////////////////
+
+static void count_int( int i )
+{
+    sink = sink + static_cast< std::uint64_t >( i );
+}
+
+struct counter_object
+{
+    void count( int i )
+    {
+        sink = sink + static_cast< std::uint64_t >( i );
+    }
+};
+
+enum observer_kind
+{
+    function_kind,
+    lambda_kind,
+    member_kind,
+    kind_count
+};
+
+static const char *kind_names[ kind_count ] = { "function", "lambda", "member" };
+
+// Every implementation provides a subject_type and an owner_type that disconnects
+// its observers when destroyed, so that all implementations run the same workloads.
+
+template< typename SUBJECT >
+struct basic_pg_impl
+{
+    using subject_type = SUBJECT;
+    using owner_type   = observer_owner;
+
+    static void connect( owner_type &owner, subject_type &s, observer_kind kind, counter_object *object )
+    {
+        switch( kind )
+        {
+        case function_kind: owner.connect( s, count_int ); break;
+        case lambda_kind:   owner.connect( s, []( int v ){ sink = sink + static_cast< std::uint64_t >( v ); } ); break;
+        default:            owner.connect( s, object, &counter_object::count ); break;
+        }
+    }
+
+    static void notify( const subject_type &s, int v )
+    {
+        s.notify( v );
+    }
+};
+
+struct pg_impl : basic_pg_impl< subject< int > >
+{
+    static constexpr const char *name = "pg";
+};
+
+struct pg_compact_impl : basic_pg_impl< compact_subject< int > >
+{
+    static constexpr const char *name = "pg_compact";
+};
+
+// Observers that are identified by a sequence number, so an owner can find and
+// erase its own observers; the common hand-written alternative.
+template< typename ENTRY >
+struct id_subject
+{
+    std::vector< std::pair< std::uint64_t, ENTRY > > observers;
+    std::uint64_t                                    next_id = 0;
+};
+
+template< typename ENTRY >
+class id_owner
+{
+    std::vector< std::pair< id_subject< ENTRY > *, std::uint64_t > > m_connections;
+
+public:
+    id_owner() = default;
+    id_owner( const id_owner & ) = delete;
+    id_owner & operator=( const id_owner & ) = delete;
+
+    ~id_owner()
+    {
+        for( const auto &c : m_connections )
+        {
+            auto &observers = c.first->observers;
+            const auto it   = std::find_if( observers.rbegin(), observers.rend(), [ &c ]( const auto &o ){ return o.first == c.second; } );
+            observers.erase( std::next( it ).base() );
+        }
+    }
+
+    void add( id_subject< ENTRY > &s, ENTRY entry )
+    {
+        const auto id = s.next_id++;
+        s.observers.emplace_back( id, std::move( entry ) );
+        m_connections.emplace_back( &s, id );
+    }
+};
+
+struct function_vector_impl
+{
+    static constexpr const char *name = "std_function";
+
+    using subject_type = id_subject< std::function< void( int ) > >;
+    using owner_type   = id_owner< std::function< void( int ) > >;
+
+    static void connect( owner_type &owner, subject_type &s, observer_kind kind, counter_object *object )
+    {
+        switch( kind )
+        {
+        case function_kind: owner.add( s, count_int ); break;
+        case lambda_kind:   owner.add( s, []( int v ){ sink = sink + static_cast< std::uint64_t >( v ); } ); break;
+        default:            owner.add( s, [ object ]( int v ){ object->count( v ); } ); break;
+        }
+    }
+
+    static void notify( const subject_type &s, int v )
+    {
+        for( const auto &o : s.observers )
+        {
+            o.second( v );
+        }
+    }
+};
+
+struct callback
+{
+    void ( *invoke )( void *, int );
+    void *context;
+};
+
+struct pointer_array_impl
+{
+    static constexpr const char *name = "pointer_array";
+
+    using subject_type = id_subject< callback >;
+    using owner_type   = id_owner< callback >;
+
+    static void connect( owner_type &owner, subject_type &s, observer_kind kind, counter_object *object )
+    {
+        switch( kind )
+        {
+        case function_kind: owner.add( s, { []( void *, int v ){ count_int( v ); }, nullptr } ); break;
+        case lambda_kind:   owner.add( s, { []( void *, int v ){ sink = sink + static_cast< std::uint64_t >( v ); }, nullptr } ); break;
+        default:            owner.add( s, { []( void *c, int v ){ static_cast< counter_object * >( c )->count( v ); }, object } ); break;
+        }
+    }
+
+    static void notify( const subject_type &s, int v )
+    {
+        for( const auto &o : s.observers )
+        {
+            o.second.invoke( o.second.context, v );
+        }
+    }
+};
+
+struct intrusive_list_impl
+{
+    static constexpr const char *name = "intrusive_list";
+
+    struct node
+    {
+        node *prev                      = this;
+        node *next                      = this;
+        void ( *invoke )( node *, int ) = nullptr;
+
+        node() = default;
+        node( const node & ) = delete;
+        node & operator=( const node & ) = delete;
+        virtual ~node() = default;
+    };
+
+    template< typename F >
+    struct callable_node : node
+    {
+        F f;
+
+        explicit callable_node( F callable )
+                : f( std::move( callable ) )
+        {
+            invoke = []( node *n, int v ){ static_cast< callable_node * >( n )->f( v ); };
+        }
+    };
+
+    // The subject is the sentinel of a circular list of the observer nodes.
+    using subject_type = node;
+
+    class owner_type
+    {
+        std::vector< std::unique_ptr< node > > m_nodes;
+
+    public:
+        owner_type() = default;
+        owner_type( const owner_type & ) = delete;
+        owner_type & operator=( const owner_type & ) = delete;
+
+        ~owner_type()
+        {
+            for( auto &n : m_nodes )
+            {
+                n->prev->next = n->next;
+                n->next->prev = n->prev;
+            }
+        }
+
+        template< typename F >
+        void add( subject_type &s, F f )
+        {
+            m_nodes.push_back( std::make_unique< callable_node< F > >( std::move( f ) ) );
+
+            auto n       = m_nodes.back().get();
+            n->prev      = s.prev;
+            n->next      = &s;
+            s.prev->next = n;
+            s.prev       = n;
+        }
+    };
+
+    static void connect( owner_type &owner, subject_type &s, observer_kind kind, counter_object *object )
+    {
+        switch( kind )
+        {
+        case function_kind: owner.add( s, count_int ); break;
+        case lambda_kind:   owner.add( s, []( int v ){ sink = sink + static_cast< std::uint64_t >( v ); } ); break;
+        default:            owner.add( s, [ object ]( int v ){ object->count( v ); } ); break;
+        }
+    }
+
+    static void notify( const subject_type &s, int v )
+    {
+        for( auto n = s.next; n != &s; n = n->next )
+        {
+            n->invoke( n, v );
+        }
+    }
+};
+
+static constexpr std::uint64_t notify_ops  = 1000000;
+static constexpr std::uint64_t connect_ops = 200000;
+static const std::size_t       fan_outs[]  = { 1, 8, 64 };
+
+template< typename IMPL >
+static void notify_benchmark( observer_kind kind, std::size_t n )
+{
+    const auto name = std::string( "notify/" ) + kind_names[ kind ] + "/" + std::to_string( n ) + "/" + IMPL::name;
+    if( selected( name ) )
+    {
+        typename IMPL::subject_type   s;
+        typename IMPL::owner_type     owner;
+        std::vector< counter_object > objects( n );
+        for( auto &o : objects )
+        {
+            IMPL::connect( owner, s, kind, &o );
+        }
+
+        const auto notifies = notify_ops / n;
+        measure( name, notifies * n, [ & ]{ for( std::uint64_t i = 0; i < notifies; ++i ) IMPL::notify( s, 1 ); } );
+    }
+}
+
+template< typename IMPL >
+static void connect_benchmark( std::size_t n )
+{
+    const auto name = "connect/" + std::to_string( n ) + "/" + IMPL::name;
+    if( selected( name ) )
+    {
+        const auto                  rounds = connect_ops / n;
+        typename IMPL::subject_type s;
+        measure( name, rounds * n, [ & ]
+        {
+            for( std::uint64_t r = 0; r < rounds; ++r )
+            {
+                typename IMPL::owner_type owner;
+                for( std::size_t i = 0; i < n; ++i )
+                {
+                    IMPL::connect( owner, s, function_kind, nullptr );
+                }
+            }
+        } );
+    }
+}
+
+template< typename IMPL >
+static void teardown_benchmark( std::size_t n )
+{
+    const auto name = "teardown/" + std::to_string( n ) + "/" + IMPL::name;
+    if( selected( name ) )
+    {
+        // Only the destruction of the owners is measured, the connects happen in the setup.
+        const auto                                                  rounds = connect_ops / n;
+        std::vector< typename IMPL::subject_type >                  subjects( rounds );
+        std::vector< std::unique_ptr< typename IMPL::owner_type > > owners;
+        const auto setup = [ & ]
+        {
+            owners.resize( rounds );
+            for( std::size_t r = 0; r < rounds; ++r )
+            {
+                owners[ r ] = std::make_unique< typename IMPL::owner_type >();
+                for( std::size_t i = 0; i < n; ++i )
+                {
+                    IMPL::connect( *owners[ r ], subjects[ r ], function_kind, nullptr );
+                }
+            }
+        };
+
+        measure( name, rounds * n, setup, [ & ]{ owners.clear(); } );
+    }
+}
+
+// Runs each workload for every implementation, so the results are listed side by side.
+template< typename ...IMPL >
+static void dispatch_benchmarks()
+{
+    for( int kind = 0; kind < kind_count; ++kind )
+    {
+        for( auto n : fan_outs )
+        {
+            ( notify_benchmark< IMPL >( static_cast< observer_kind >( kind ), n ), ... );
+        }
+    }
+
+    for( auto n : fan_outs )
+    {
+        ( connect_benchmark< IMPL >( n ), ... );
+    }
+
+    for( auto n : fan_outs )
+    {
+        ( teardown_benchmark< IMPL >( n ), ... );
+    }
+}
+
+// Describes a generated subject graph. Every root subject forwards through a
+// chain of 'chain_depth' subjects and every subject in the graph gets a number
+// of observers drawn from the fan-out distribution. 'churn' is the number of
+// connect/disconnect pairs per notify.
+struct topology_config
+{
+    enum distribution_t { uniform, zipf };
+
+    const char     *name;
+    std::size_t    roots;
+    distribution_t distribution;
+    std::size_t    max_fan_out;
+    double         zipf_exponent;
+    std::size_t    chain_depth;
+    double         kind_mix[ kind_count ];
+    double         churn;
+    std::uint64_t  notifies;
+};
+
+static const topology_config topologies[] =
+{
+    { "topology/uniform",        1000, topology_config::uniform, 16,  0.0, 0, { 1, 1, 1 }, 0.0,  200000 },
+    { "topology/zipf",           1000, topology_config::zipf,    256, 1.2, 0, { 1, 1, 1 }, 0.0,  200000 },
+    { "topology/zipf/chain4",    250,  topology_config::zipf,    256, 1.2, 4, { 1, 1, 1 }, 0.0,  100000 },
+    { "topology/zipf/churn",     1000, topology_config::zipf,    256, 1.2, 0, { 1, 1, 1 }, 0.1,  200000 },
+    { "topology/members/chain2", 500,  topology_config::uniform, 32,  0.0, 2, { 0, 1, 3 }, 0.01, 100000 }
+};
+
+class topology
+{
+    static constexpr std::size_t owner_count = 64;
+
+    const topology_config             &m_config;
+    std::mt19937_64                   m_random;
+    std::discrete_distribution< int > m_kinds;
+    std::vector< double >             m_zipf_cdf;
+
+    // Subjects are destroyed after the owners, so teardown runs through the owners.
+    std::deque< subject< int > >    m_subjects;
+    std::deque< counter_object >    m_objects;
+    std::vector< observer_owner >   m_owners = std::vector< observer_owner >( owner_count );
+    observer_owner                  m_churn_owner;
+    std::deque< connection >        m_churn_handles;
+    std::vector< std::size_t >      m_sequence;
+
+    std::size_t fan_out()
+    {
+        if( m_config.distribution == topology_config::uniform )
+        {
+            return std::uniform_int_distribution< std::size_t >( 1, m_config.max_fan_out )( m_random );
+        }
+
+        const auto u = std::uniform_real_distribution< double >( 0.0, m_zipf_cdf.back() )( m_random );
+        return static_cast< std::size_t >( std::lower_bound( m_zipf_cdf.begin(), m_zipf_cdf.end(), u ) - m_zipf_cdf.begin() ) + 1;
+    }
+
+    void connect( observer_owner &owner, subject< int > &s )
+    {
+        pg_impl::connect( owner, s, static_cast< observer_kind >( m_kinds( m_random ) ), &m_objects.emplace_back() );
+    }
+
+    void churn()
+    {
+        auto &s = m_subjects[ std::uniform_int_distribution< std::size_t >( 0, m_subjects.size() - 1 )( m_random ) ];
+        m_churn_handles.push_back( m_churn_owner.connect( s, count_int ) );
+        if( m_churn_handles.size() > m_subjects.size() )
+        {
+            m_churn_owner.disconnect( m_churn_handles.front() );
+            m_churn_handles.pop_front();
+        }
+    }
+
+public:
+    explicit topology( const topology_config &config )
+            : m_config( config )
+            , m_random( 1003 )
+            , m_kinds( std::begin( config.kind_mix ), std::end( config.kind_mix ) )
+    {
+        double sum = 0.0;
+        for( std::size_t k = 1; k <= config.max_fan_out; ++k )
+        {
+            sum += 1.0 / std::pow( static_cast< double >( k ), config.zipf_exponent );
+            m_zipf_cdf.push_back( sum );
+        }
+
+        std::vector< std::size_t > roots;
+        for( std::size_t r = 0; r < config.roots; ++r )
+        {
+            roots.push_back( m_subjects.size() );
+            m_subjects.emplace_back();
+            for( std::size_t d = 0; d < config.chain_depth; ++d )
+            {
+                auto &source = m_subjects.back();
+                m_owners[ m_subjects.size() % owner_count ].connect( source, m_subjects.emplace_back() );
+            }
+        }
+
+        for( auto &s : m_subjects )
+        {
+            for( auto n = fan_out(); n > 0; --n )
+            {
+                connect( m_owners[ std::uniform_int_distribution< std::size_t >( 0, owner_count - 1 )( m_random ) ], s );
+            }
+        }
+
+        // The roots to notify are drawn up front, so the random generator is not measured.
+        std::uniform_int_distribution< std::size_t > root( 0, roots.size() - 1 );
+        m_sequence.resize( config.notifies );
+        for( auto &i : m_sequence )
+        {
+            i = roots[ root( m_random ) ];
+        }
+    }
+
+    void run( std::vector< double > &latencies )
+    {
+        double churn_debt = 0.0;
+        for( auto i : m_sequence )
+        {
+            const auto start = std::chrono::steady_clock::now();
+            m_subjects[ i ].notify( 1 );
+            const auto end   = std::chrono::steady_clock::now();
+            latencies.push_back( std::chrono::duration< double, std::nano >( end - start ).count() );
+
+            for( churn_debt += m_config.churn; churn_debt >= 1.0; churn_debt -= 1.0 )
+            {
+                churn();
+            }
+        }
+    }
+};
+
+static void topology_benchmarks()
+{
+    for( const auto &config : topologies )
+    {
+        if( selected( config.name ) )
+        {
+            topology graph( config );
+            measure( config.name, config.notifies, []{}, [ &graph ]( std::vector< double > &latencies ){ graph.run( latencies ); } );
+        }
+    }
+}
+
+// The ping-pong benchmarks hand every notification to another thread, the way
+// a queued or thread-affine delivery would: the observer of 'ping' posts the
+// value to thread B, which notifies 'pong', whose observer posts it back to
+// thread A. A mailbox holds one value and differs in how the receiver waits.
+
+static void cpu_relax() noexcept
+{
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+    __builtin_ia32_pause();
+#endif
+}
+
+// Spins on the value; it only yields when the peer did not answer for a while,
+// or right away on a single CPU where the peer can not run while spinning.
+class busy_poll_mailbox
+{
+    std::atomic< std::uint64_t > m_value = { 0 };
+    const int                    m_spins = std::thread::hardware_concurrency() > 1 ? 4096 : 0;
+
+public:
+    void post( std::uint64_t value ) noexcept
+    {
+        m_value.store( value, std::memory_order_release );
+    }
+
+    std::uint64_t wait() noexcept
+    {
+        for( int spins = 0;; ++spins )
+        {
+            if( m_value.load( std::memory_order_relaxed ) )
+            {
+                return m_value.exchange( 0, std::memory_order_acquire );
+            }
+
+            if( spins < m_spins )
+            {
+                cpu_relax();
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+};
+
+#if defined( __linux__ )
+
+class futex_mailbox
+{
+    std::atomic< std::uint64_t > m_value = { 0 };
+    std::atomic< std::uint32_t > m_ready = { 0 };
+
+    static_assert( sizeof( std::atomic< std::uint32_t > ) == sizeof( std::uint32_t ), "futex word must be 32 bits" );
+
+public:
+    void post( std::uint64_t value ) noexcept
+    {
+        m_value.store( value, std::memory_order_relaxed );
+        m_ready.store( 1, std::memory_order_release );
+        syscall( SYS_futex, &m_ready, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0 );
+    }
+
+    std::uint64_t wait() noexcept
+    {
+        while( m_ready.exchange( 0, std::memory_order_acquire ) == 0 )
+        {
+            syscall( SYS_futex, &m_ready, FUTEX_WAIT_PRIVATE, 0, nullptr, nullptr, 0 );
+        }
+
+        return m_value.load( std::memory_order_relaxed );
+    }
+};
+
+class eventfd_mailbox
+{
+    std::atomic< std::uint64_t > m_value = { 0 };
+    const int                    m_fd    = eventfd( 0, EFD_CLOEXEC );
+
+public:
+    eventfd_mailbox()
+    {
+        if( m_fd < 0 )
+        {
+            throw std::system_error( errno, std::system_category(), "eventfd" );
+        }
+    }
+
+    ~eventfd_mailbox() noexcept
+    {
+        close( m_fd );
+    }
+
+    eventfd_mailbox( const eventfd_mailbox & )             = delete;
+    eventfd_mailbox & operator=( const eventfd_mailbox & ) = delete;
+
+    void post( std::uint64_t value ) noexcept
+    {
+        m_value.store( value, std::memory_order_relaxed );
+
+        const std::uint64_t one = 1;
+        while( write( m_fd, &one, sizeof( one ) ) < 0 && errno == EINTR ) {}
+    }
+
+    std::uint64_t wait() noexcept
+    {
+        std::uint64_t count;
+        while( read( m_fd, &count, sizeof( count ) ) < 0 && errno == EINTR ) {}
+
+        return m_value.load( std::memory_order_relaxed );
+    }
+};
+
+// Pins the calling thread to 'cpu' for the lifetime of the pin and restores its
+// previous affinity afterwards. Pinning is skipped when the CPU does not exist.
+class cpu_pin
+{
+    cpu_set_t m_previous;
+    bool      m_pinned = false;
+
+public:
+    explicit cpu_pin( unsigned cpu ) noexcept
+    {
+        if( cpu >= std::thread::hardware_concurrency() || pthread_getaffinity_np( pthread_self(), sizeof( m_previous ), &m_previous ) != 0 )
+        {
+            return;
+        }
+
+        cpu_set_t set;
+        CPU_ZERO( &set );
+        CPU_SET( cpu, &set );
+        m_pinned = pthread_setaffinity_np( pthread_self(), sizeof( set ), &set ) == 0;
+    }
+
+    ~cpu_pin() noexcept
+    {
+        if( m_pinned )
+        {
+            pthread_setaffinity_np( pthread_self(), sizeof( m_previous ), &m_previous );
+        }
+    }
+
+    cpu_pin( const cpu_pin & )             = delete;
+    cpu_pin & operator=( const cpu_pin & ) = delete;
+};
+
+#else
+
+struct cpu_pin
+{
+    explicit cpu_pin( unsigned ) noexcept {}
+};
+
+#endif
+
+static constexpr std::uint64_t ping_pong_rounds = 20000;
+static constexpr std::uint64_t ping_pong_stop   = ~std::uint64_t( 0 );
+
+template< typename MAILBOX >
+static void ping_pong_benchmark( const char *strategy )
+{
+    const auto name = std::string( "ping_pong/" ) + strategy;
+    if( selected( name ) )
+    {
+        MAILBOX                  to_a;
+        MAILBOX                  to_b;
+        subject< std::uint64_t > ping;
+        subject< std::uint64_t > pong;
+        observer_owner           owner;
+
+        owner.connect( ping, [ &to_b ]( std::uint64_t v ){ to_b.post( v ); } );
+        owner.connect( pong, [ &to_a ]( std::uint64_t v ){ to_a.post( v ); } );
+
+        std::thread b( [ & ]
+        {
+            const cpu_pin pin( 1 );
+            for( auto v = to_b.wait(); v != ping_pong_stop; v = to_b.wait() )
+            {
+                pong.notify( v );
+            }
+        } );
+
+        {
+            const cpu_pin pin( 0 );
+            measure( name, ping_pong_rounds, []{}, [ & ]( std::vector< double > &latencies )
+            {
+                for( std::uint64_t i = 1; i <= ping_pong_rounds; ++i )
+                {
+                    const auto start = std::chrono::steady_clock::now();
+                    ping.notify( i );
+                    to_a.wait();
+                    const auto end   = std::chrono::steady_clock::now();
+                    latencies.push_back( std::chrono::duration< double, std::nano >( end - start ).count() );
+                }
+            } );
+        }
+
+        ping.notify( ping_pong_stop );
+        b.join();
+    }
+}
+
+static void ping_pong_benchmarks()
+{
+    ping_pong_benchmark< busy_poll_mailbox >( "busy_poll" );
+#if defined( __linux__ )
+    ping_pong_benchmark< futex_mailbox >( "futex" );
+    ping_pong_benchmark< eventfd_mailbox >( "eventfd" );
+#endif
+}
+
+// The queued benchmarks model a subject that is notified from producer threads
+// and delivered by 1, 2 or 4 dispatcher threads through a bounded queue, the way
+// a queued subject would. Producers emit bursts on a fixed schedule; the queue
+// time of an event runs from its scheduled send time, not from when the producer
+// got to send it, so stalls caused by backpressure are not hidden (coordinated
+// omission).
+
+static thread_local std::uint64_t thread_sink = 0;
+
+// Observers that are called from several threads at once count per thread.
+static void count_thread_int( int i )
+{
+    thread_sink += static_cast< std::uint64_t >( i );
+}
+
+struct queued_config
+{
+    enum policy_t { block, drop };
+
+    const char    *name;
+    policy_t      policy;
+    std::size_t   capacity;
+    unsigned      producers;
+    double        rate;      // Events per second over all producers.
+    std::size_t   burst;
+    std::uint64_t events;    // Events per producer.
+    std::size_t   fan_out;
+};
+
+static const queued_config queued_configs[] =
+{
+    { "queued/block/64",   queued_config::block, 64,   4, 200000.0, 64, 10000, 8 },
+    { "queued/block/1024", queued_config::block, 1024, 4, 200000.0, 64, 10000, 8 },
+    { "queued/drop/64",    queued_config::drop,  64,   4, 200000.0, 64, 10000, 8 },
+    { "queued/drop/1024",  queued_config::drop,  1024, 4, 200000.0, 64, 10000, 8 }
+};
+
+static const unsigned queued_dispatchers[] = { 1, 2, 4 };
+
+class bounded_queue
+{
+public:
+    using time_point = std::chrono::steady_clock::time_point;
+
+    struct event
+    {
+        time_point scheduled;
+        int        value;
+    };
+
+private:
+    std::mutex              m_mutex;
+    std::condition_variable m_not_empty;
+    std::condition_variable m_not_full;
+    std::vector< event >    m_ring;
+    std::size_t             m_head   = 0;
+    std::size_t             m_size   = 0;
+    bool                    m_closed = false;
+
+public:
+    explicit bounded_queue( std::size_t capacity )
+            : m_ring( capacity )
+    {}
+
+    // Returns false when the event was dropped because the queue is full and 'wait' is false.
+    bool push( const event &e, bool wait )
+    {
+        std::unique_lock< std::mutex > lock( m_mutex );
+        if( m_size == m_ring.size() )
+        {
+            if( !wait )
+            {
+                return false;
+            }
+            m_not_full.wait( lock, [ this ]{ return m_size < m_ring.size(); } );
+        }
+
+        m_ring[ ( m_head + m_size++ ) % m_ring.size() ] = e;
+        lock.unlock();
+        m_not_empty.notify_one();
+
+        return true;
+    }
+
+    // Returns false when the queue is closed and empty.
+    bool pop( event &e )
+    {
+        std::unique_lock< std::mutex > lock( m_mutex );
+        m_not_empty.wait( lock, [ this ]{ return m_size || m_closed; } );
+        if( !m_size )
+        {
+            return false;
+        }
+
+        e      = m_ring[ m_head ];
+        m_head = ( m_head + 1 ) % m_ring.size();
+        --m_size;
+        lock.unlock();
+        m_not_full.notify_one();
+
+        return true;
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard< std::mutex > lock( m_mutex );
+            m_closed = true;
+        }
+        m_not_empty.notify_all();
+    }
+};
+
+struct queued_run
+{
+    std::vector< double > queue_times;
+    std::vector< double > service_times;
+    std::uint64_t         dropped;
+    double                seconds;
+};
+
+static queued_run run_queued( const queued_config &config, unsigned dispatchers )
+{
+    using clock = std::chrono::steady_clock;
+
+    bounded_queue  queue( config.capacity );
+    subject< int > s;
+    observer_owner owner;
+    for( std::size_t i = 0; i < config.fan_out; ++i )
+    {
+        owner.connect( s, count_thread_int );
+    }
+
+    // Each dispatcher records its own times; they are merged after the run.
+    std::vector< queued_run >  dispatched( dispatchers, queued_run{ {}, {}, 0, 0.0 } );
+    std::vector< std::thread > dispatcher_threads;
+    for( auto &d : dispatched )
+    {
+        d.queue_times.reserve( config.events * config.producers / dispatchers );
+        d.service_times.reserve( config.events * config.producers / dispatchers );
+        dispatcher_threads.emplace_back( [ & ]
+        {
+            bounded_queue::event e;
+            while( queue.pop( e ) )
+            {
+                const auto start = clock::now();
+                s.notify( e.value );
+                const auto end   = clock::now();
+                d.queue_times.push_back( std::chrono::duration< double, std::nano >( start - e.scheduled ).count() );
+                d.service_times.push_back( std::chrono::duration< double, std::nano >( end - start ).count() );
+            }
+        } );
+    }
+
+    const auto                   burst_interval = std::chrono::duration< double >( static_cast< double >( config.burst * config.producers ) / config.rate );
+    const auto                   start          = clock::now() + std::chrono::milliseconds( 1 );
+    std::atomic< std::uint64_t > dropped        = { 0 };
+    std::vector< std::thread >   producers;
+    for( unsigned p = 0; p < config.producers; ++p )
+    {
+        producers.emplace_back( [ &, p ]
+        {
+            // Producers are staggered so their bursts interleave at the configured total rate.
+            const auto offset = burst_interval * ( static_cast< double >( p ) / config.producers );
+            for( std::uint64_t sent = 0, burst = 0; sent < config.events; ++burst )
+            {
+                const auto scheduled = start + std::chrono::duration_cast< clock::duration >( offset + burst_interval * static_cast< double >( burst ) );
+                std::this_thread::sleep_until( scheduled );
+
+                for( std::size_t i = 0; i < config.burst && sent < config.events; ++i, ++sent )
+                {
+                    if( !queue.push( { scheduled, 1 }, config.policy == queued_config::block ) )
+                    {
+                        dropped.fetch_add( 1, std::memory_order_relaxed );
+                    }
+                }
+            }
+        } );
+    }
+
+    for( auto &p : producers )
+    {
+        p.join();
+    }
+    queue.close();
+    for( auto &d : dispatcher_threads )
+    {
+        d.join();
+    }
+
+    queued_run run = { {}, {}, 0, 0.0 };
+    for( auto &d : dispatched )
+    {
+        run.queue_times.insert( run.queue_times.end(), d.queue_times.begin(), d.queue_times.end() );
+        run.service_times.insert( run.service_times.end(), d.service_times.begin(), d.service_times.end() );
+    }
+    run.dropped = dropped.load();
+    run.seconds = std::chrono::duration< double >( clock::now() - start ).count();
+
+    return run;
+}
+
+// Reports the queue time and the service time as separate results; the time per
+// operation of both is the wall-clock time per delivered event.
+static void queued_benchmarks()
+{
+    for( const auto &config : queued_configs )
+    {
+        for( const auto dispatchers : queued_dispatchers )
+        {
+            char name[ 64 ];
+            std::snprintf( name, sizeof( name ), "%s/dispatchers%u", config.name, dispatchers );
+            if( !selected( name ) )
+            {
+                continue;
+            }
+
+            counter_values no_counters;
+            no_counters.fill( NAN );
+
+            result        queue_time   = { std::string( name ) + "/queue_time", {}, {}, {} };
+            result        service_time = { std::string( name ) + "/service_time", {}, {}, {} };
+            std::uint64_t dropped      = 0;
+
+            run_queued( config, dispatchers );
+            for( int i = 0; i < repetitions; ++i )
+            {
+                auto       run       = run_queued( config, dispatchers );
+                const auto delivered = static_cast< double >( run.service_times.size() );
+                const auto ns_per_op = delivered ? run.seconds * 1e9 / delivered : NAN;
+
+                for( auto r : { &queue_time, &service_time } )
+                {
+                    r->ns_per_op.push_back( ns_per_op );
+                    r->per_op.push_back( no_counters );
+                }
+                queue_time.latency.push_back( percentiles( run.queue_times ) );
+                service_time.latency.push_back( percentiles( run.service_times ) );
+                dropped += run.dropped;
+            }
+
+            results.push_back( std::move( queue_time ) );
+            results.push_back( std::move( service_time ) );
+            if( config.policy == queued_config::drop )
+            {
+                char note[ 128 ];
+                std::snprintf( note, sizeof( note ), "%s dropped %.2f%% of the events", name,
+                               100.0 * static_cast< double >( dropped ) / static_cast< double >( config.events * config.producers * static_cast< std::uint64_t >( repetitions ) ) );
+                notes.push_back( note );
+            }
+        }
+    }
+}
+
+// The scaling benchmarks run 1 to N threads that notify one shared subject and,
+// for a configurable share of the operations, connect and disconnect an
+// observer. pg::subject is not thread-safe, so it is measured behind a mutex as
+// the baseline; the reader-writer variant notifies under a shared lock.
+
+template< typename MUTEX, typename NOTIFY_LOCK >
+struct locked_subject_impl
+{
+    MUTEX          mutex;
+    subject< int > s;
+
+    void notify()
+    {
+        const NOTIFY_LOCK lock( mutex );
+        s.notify( 1 );
+    }
+
+    connection connect( observer_owner &owner )
+    {
+        const std::lock_guard< MUTEX > lock( mutex );
+        return owner.connect( s, count_thread_int );
+    }
+
+    void disconnect( observer_owner &owner, connection handle )
+    {
+        const std::lock_guard< MUTEX > lock( mutex );
+        owner.disconnect( handle );
+    }
+};
+
+struct mutex_subject_impl : locked_subject_impl< std::mutex, std::lock_guard< std::mutex > >
+{
+    static constexpr const char *name = "mutex";
+};
+
+struct shared_mutex_subject_impl : locked_subject_impl< std::shared_mutex, std::shared_lock< std::shared_mutex > >
+{
+    static constexpr const char *name = "shared_mutex";
+};
+
+static constexpr std::uint64_t scaling_ops     = 200000;    // Operations per thread.
+static constexpr std::size_t   scaling_fan_out = 8;
+static const double            churn_ratios[]  = { 0.0, 0.01, 0.1 };
+static unsigned                max_threads     = 0;
+
+template< typename IMPL >
+static double scaling_benchmark( double churn, unsigned threads )
+{
+    char name[ 64 ];
+    std::snprintf( name, sizeof( name ), "scaling/%s/churn%g/%u", IMPL::name, churn * 100.0, threads );
+    if( !selected( name ) )
+    {
+        return NAN;
+    }
+
+    IMPL           impl;
+    observer_owner owner;
+    for( std::size_t i = 0; i < scaling_fan_out; ++i )
+    {
+        impl.connect( owner );
+    }
+
+    const auto every = churn > 0.0 ? static_cast< std::uint64_t >( 1.0 / churn ) : 0;
+    measure( name, scaling_ops * threads, [ & ]
+    {
+        std::atomic< unsigned >    ready = { 0 };
+        std::vector< std::thread > workers;
+        for( unsigned t = 0; t < threads; ++t )
+        {
+            workers.emplace_back( [ & ]
+            {
+                observer_owner thread_owner;
+
+                ready.fetch_add( 1 );
+                while( ready.load() < threads )
+                {
+                    std::this_thread::yield();
+                }
+
+                for( std::uint64_t i = 1; i <= scaling_ops; ++i )
+                {
+                    if( every && i % every == 0 )
+                    {
+                        impl.disconnect( thread_owner, impl.connect( thread_owner ) );
+                    }
+                    else
+                    {
+                        impl.notify();
+                    }
+                }
+            } );
+        }
+
+        for( auto &w : workers )
+        {
+            w.join();
+        }
+    } );
+
+    return median( results.back().ns_per_op );
+}
+
+static void scaling_benchmarks()
+{
+    const auto n = max_threads ? max_threads : std::max( 1u, std::thread::hardware_concurrency() );
+
+    std::vector< unsigned > sweep;
+    for( unsigned t = 1; t < n; t *= 2 )
+    {
+        sweep.push_back( t );
+    }
+    sweep.push_back( n );
+
+    bool header = false;
+    for( auto churn : churn_ratios )
+    {
+        for( auto threads : sweep )
+        {
+            const auto baseline = scaling_benchmark< mutex_subject_impl >( churn, threads );
+            const auto shared   = scaling_benchmark< shared_mutex_subject_impl >( churn, threads );
+
+            for( const auto &r : { std::make_pair( mutex_subject_impl::name, baseline ), std::make_pair( shared_mutex_subject_impl::name, shared ) } )
+            {
+                if( std::isnan( r.second ) )
+                {
+                    continue;
+                }
+
+                if( !header )
+                {
+                    char line[ 128 ];
+                    std::snprintf( line, sizeof( line ), "%-14s %8s %8s %16s %10s", "scaling", "churn", "threads", "ops/s/thread", "speedup" );
+                    notes.push_back( line );
+                    header = true;
+                }
+
+                // Throughput per thread, and speedup over the mutex baseline at the same thread count.
+                char line[ 128 ];
+                std::snprintf( line, sizeof( line ), "%-14s %7g%% %8u %16.0f %9.2fx", r.first, churn * 100.0, threads,
+                               1e9 / r.second / threads, std::isnan( baseline ) ? NAN : baseline / r.second );
+                notes.push_back( line );
+            }
+        }
+    }
+}
+
+int main( int argc, char *argv[] )
+{
+    const char *json = nullptr;
+
+    for( int i = 1; i < argc; ++i )
+    {
+        const std::string arg = argv[ i ];
+        if( arg == "--repetitions" && i + 1 < argc )
+        {
+            repetitions = std::max( 1, std::atoi( argv[ ++i ] ) );
+        }
+        else if( arg == "--threads" && i + 1 < argc )
+        {
+            max_threads = static_cast< unsigned >( std::max( 1, std::atoi( argv[ ++i ] ) ) );
+        }
+        else if( arg == "--json" && i + 1 < argc )
+        {
+            json = argv[ ++i ];
+        }
+        else if( arg.compare( 0, 2, "--" ) == 0 )
+        {
+            std::fprintf( stderr, "usage: %s [--repetitions n] [--threads n] [--json path] [filter]\n", argv[ 0 ] );
+            return 2;
+        }
+        else
+        {
+            filter = argv[ i ];
+        }
+    }
+
+    if( !counters.available() )
+    {
+        std::fprintf( stderr, "Hardware perf counters are unavailable, only wall-clock time is reported.\n" );
+    }
+
+    dispatch_benchmarks< pg_impl, pg_compact_impl, function_vector_impl, pointer_array_impl, intrusive_list_impl >();
+    topology_benchmarks();
+    ping_pong_benchmarks();
+    queued_benchmarks();
+    scaling_benchmarks();
+
+    print_results();
+
+    if( json && !write_json( json ) )
+    {
+        std::fprintf( stderr, "Failed to write %s\n", json );
+        return 1;
+    }
+
+    return 0;
+}
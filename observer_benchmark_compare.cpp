@@ -0,0 +1,383 @@
+// Compares two result files written by 'observer_benchmark --json' and exits
+// with 1 when a benchmark regressed beyond the threshold.
+//
+// A benchmark regresses when the median of the current repetitions is more than
+// 'threshold' percent above the median of the baseline repetitions, and the
+// difference is also larger than 'noise' times the spread of the repetitions
+// (the median absolute deviation scaled to a standard deviation). The second
+// condition keeps a noisy machine from failing the comparison.
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+///////////////////////////////////////////////////////////////////////////////
+//                                JSON reader                                //
+///////////////////////////////////////////////////////////////////////////////
+
+struct json_value
+{
+    enum kind_t { null, boolean, number, string, array, object } kind = null;
+
+    double                              number_value = 0.0;
+    std::string                         string_value;
+    std::vector< json_value >           elements;
+    std::map< std::string, json_value > members;
+
+    const json_value * find( const std::string &key ) const
+    {
+        const auto it = members.find( key );
+        return it == members.end() ? nullptr : &it->second;
+    }
+};
+
+// Just enough JSON for the result files; fails on anything malformed.
+class json_parser
+{
+    const std::string &m_text;
+    std::size_t        m_pos = 0;
+
+    void skip_space()
+    {
+        while( m_pos < m_text.size() && std::isspace( static_cast< unsigned char >( m_text[ m_pos ] ) ) )
+        {
+            ++m_pos;
+        }
+    }
+
+    bool consume( char c )
+    {
+        skip_space();
+        if( m_pos < m_text.size() && m_text[ m_pos ] == c )
+        {
+            ++m_pos;
+            return true;
+        }
+
+        return false;
+    }
+
+    bool consume( const char *word )
+    {
+        const auto n = std::char_traits< char >::length( word );
+        if( m_text.compare( m_pos, n, word ) == 0 )
+        {
+            m_pos += n;
+            return true;
+        }
+
+        return false;
+    }
+
+    bool parse_string( std::string &out )
+    {
+        if( !consume( '"' ) )
+        {
+            return false;
+        }
+
+        while( m_pos < m_text.size() && m_text[ m_pos ] != '"' )
+        {
+            char c = m_text[ m_pos++ ];
+            if( c == '\\' && m_pos < m_text.size() )
+            {
+                c = m_text[ m_pos++ ];
+                c = c == 'n' ? '\n' : c == 't' ? '\t' : c;
+            }
+            out += c;
+        }
+
+        return m_pos++ < m_text.size();
+    }
+
+public:
+    explicit json_parser( const std::string &text )
+            : m_text( text )
+    {}
+
+    bool parse( json_value &v )
+    {
+        skip_space();
+        if( m_pos >= m_text.size() )
+        {
+            return false;
+        }
+
+        const char c = m_text[ m_pos ];
+        if( c == '{' )
+        {
+            v.kind = json_value::object;
+            ++m_pos;
+            if( consume( '}' ) )
+            {
+                return true;
+            }
+            do
+            {
+                std::string key;
+                if( !parse_string( key ) || !consume( ':' ) || !parse( v.members[ key ] ) )
+                {
+                    return false;
+                }
+            }
+            while( consume( ',' ) );
+
+            return consume( '}' );
+        }
+        if( c == '[' )
+        {
+            v.kind = json_value::array;
+            ++m_pos;
+            if( consume( ']' ) )
+            {
+                return true;
+            }
+            do
+            {
+                v.elements.emplace_back();
+                if( !parse( v.elements.back() ) )
+                {
+                    return false;
+                }
+            }
+            while( consume( ',' ) );
+
+            return consume( ']' );
+        }
+        if( c == '"' )
+        {
+            v.kind = json_value::string;
+            return parse_string( v.string_value );
+        }
+        if( consume( "null" ) )
+        {
+            v.kind = json_value::null;
+            return true;
+        }
+        if( consume( "true" ) )
+        {
+            v.kind         = json_value::boolean;
+            v.number_value = 1.0;
+            return true;
+        }
+        if( consume( "false" ) )
+        {
+            v.kind = json_value::boolean;
+            return true;
+        }
+
+        char       *end   = nullptr;
+        const auto  start = m_text.c_str() + m_pos;
+        v.kind            = json_value::number;
+        v.number_value    = std::strtod( start, &end );
+        m_pos            += static_cast< std::size_t >( end - start );
+
+        return end != start;
+    }
+
+    bool done()
+    {
+        skip_space();
+        return m_pos == m_text.size();
+    }
+};
+
+// Reads the samples of 'metric' per benchmark name, in file order.
+static bool load( const char *path, const std::string &metric, std::vector< std::pair< std::string, std::vector< double > > > &out )
+{
+    std::ifstream     file( path, std::ios::binary );
+    std::stringstream text;
+    text << file.rdbuf();
+    if( !file )
+    {
+        std::fprintf( stderr, "Can not read %s\n", path );
+        return false;
+    }
+
+    const auto  content = text.str();
+    json_value  root;
+    json_parser parser( content );
+    if( !parser.parse( root ) || !parser.done() || root.kind != json_value::object )
+    {
+        std::fprintf( stderr, "%s is not valid JSON\n", path );
+        return false;
+    }
+
+    const auto benchmarks = root.find( "benchmarks" );
+    if( !benchmarks || benchmarks->kind != json_value::array )
+    {
+        std::fprintf( stderr, "%s has no benchmarks\n", path );
+        return false;
+    }
+
+    for( const auto &b : benchmarks->elements )
+    {
+        const auto name    = b.find( "name" );
+        const auto samples = b.find( metric );
+        if( !name || name->kind != json_value::string )
+        {
+            continue;
+        }
+
+        std::vector< double > values;
+        if( samples && samples->kind == json_value::array )
+        {
+            for( const auto &s : samples->elements )
+            {
+                if( s.kind == json_value::number )
+                {
+                    values.push_back( s.number_value );
+                }
+            }
+        }
+        out.emplace_back( name->string_value, std::move( values ) );
+    }
+
+    return true;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+//                                Statistics                                 //
+///////////////////////////////////////////////////////////////////////////////
+
+static double median( std::vector< double > values )
+{
+    if( values.empty() )
+    {
+        return NAN;
+    }
+
+    std::sort( values.begin(), values.end() );
+    const auto n = values.size();
+
+    return n % 2 ? values[ n / 2 ] : ( values[ n / 2 - 1 ] + values[ n / 2 ] ) / 2.0;
+}
+
+// The median absolute deviation, scaled to estimate the standard deviation of normally distributed samples.
+static double scaled_mad( const std::vector< double > &values )
+{
+    const auto m = median( values );
+
+    std::vector< double > deviations;
+    for( auto v : values )
+    {
+        deviations.push_back( std::fabs( v - m ) );
+    }
+
+    return 1.4826 * median( deviations );
+}
+
+int main( int argc, char *argv[] )
+{
+    double      threshold  = 5.0;
+    double      noise      = 3.0;
+    std::string metric     = "ns_per_op";
+    const char *paths[ 2 ] = { nullptr, nullptr };
+    int         files      = 0;
+
+    for( int i = 1; i < argc; ++i )
+    {
+        const std::string arg = argv[ i ];
+        if( arg == "--threshold" && i + 1 < argc )
+        {
+            threshold = std::atof( argv[ ++i ] );
+        }
+        else if( arg == "--noise" && i + 1 < argc )
+        {
+            noise = std::atof( argv[ ++i ] );
+        }
+        else if( arg == "--metric" && i + 1 < argc )
+        {
+            metric = argv[ ++i ];
+        }
+        else if( arg.compare( 0, 2, "--" ) != 0 && files < 2 )
+        {
+            paths[ files++ ] = argv[ i ];
+        }
+        else
+        {
+            files = 0;
+            break;
+        }
+    }
+
+    if( files != 2 )
+    {
+        std::fprintf( stderr, "usage: %s [--threshold percent] [--noise k] [--metric name] baseline.json current.json\n", argv[ 0 ] );
+        return 2;
+    }
+
+    std::vector< std::pair< std::string, std::vector< double > > > baseline;
+    std::vector< std::pair< std::string, std::vector< double > > > current;
+    if( !load( paths[ 0 ], metric, baseline ) || !load( paths[ 1 ], metric, current ) )
+    {
+        return 2;
+    }
+
+    std::printf( "%-48s %12s %12s %9s %10s  %s\n", "benchmark", "baseline", "current", "change", "noise", "verdict" );
+
+    int regressions = 0;
+    for( const auto &c : current )
+    {
+        const auto b = std::find_if( baseline.begin(), baseline.end(), [ &c ]( const auto &e ){ return e.first == c.first; } );
+        if( b == baseline.end() )
+        {
+            std::printf( "%-48s %12s %12.2f %9s %10s  new\n", c.first.c_str(), "-", median( c.second ), "-", "-" );
+            continue;
+        }
+        if( b->second.empty() || c.second.empty() )
+        {
+            std::printf( "%-48s %12s %12s %9s %10s  n/a\n", c.first.c_str(), "-", "-", "-", "-" );
+            continue;
+        }
+
+        const auto base   = median( b->second );
+        const auto cur    = median( c.second );
+        const auto change = base != 0.0 ? ( cur - base ) / base * 100.0 : 0.0;
+        const auto spread = std::max( scaled_mad( b->second ), scaled_mad( c.second ) );
+
+        const char *verdict = "ok";
+        if( std::fabs( change ) > threshold )
+        {
+            if( std::fabs( cur - base ) <= noise * spread )
+            {
+                verdict = "noisy";
+            }
+            else if( change > 0.0 )
+            {
+                verdict = "REGRESSION";
+                ++regressions;
+            }
+            else
+            {
+                verdict = "improved";
+            }
+        }
+
+        std::printf( "%-48s %12.2f %12.2f %+8.1f%% %10.2f  %s\n", c.first.c_str(), base, cur, change, spread, verdict );
+    }
+
+    for( const auto &b : baseline )
+    {
+        if( std::none_of( current.begin(), current.end(), [ &b ]( const auto &e ){ return e.first == b.first; } ) )
+        {
+            std::printf( "%-48s %12.2f %12s %9s %10s  missing\n", b.first.c_str(), median( b.second ), "-", "-", "-" );
+        }
+    }
+
+    if( regressions )
+    {
+        std::printf( "%d benchmark(s) regressed more than %.1f%%\n", regressions, threshold );
+    }
+
+    return regressions ? 1 : 0;
+}
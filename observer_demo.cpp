@@ -1,6 +1,10 @@
 #include "observer.h"
+#include "observer_payload.h"
+#include "observer_journal.h"
+#include "observer_window.h"
 #include <iostream>
 #include <string>
+#include <cstdio>
 
 
 using namespace pg;
@@ -52,6 +56,29 @@ struct member_observers_with_owner : private observer_owner, public member_obser
     {}
 };
 
+struct print_hooks : no_hooks
+{
+    static void on_notify_begin( const void * /* subject */, std::size_t observers ) noexcept
+    {
+        std::cout << "print_hooks::on_notify_begin - " << observers << " observers" << std::endl;
+    }
+
+    static void on_notify_end( const void * /* subject */ ) noexcept
+    {
+        std::cout << "print_hooks::on_notify_end" << std::endl;
+    }
+
+    static void on_connect( const void * /* owner */, const void * /* subject */, const observer_handle * /* observer */ ) noexcept
+    {
+        std::cout << "print_hooks::on_connect" << std::endl;
+    }
+
+    static void on_disconnect( const void * /* owner */, const observer_handle * /* observer */ ) noexcept
+    {
+        std::cout << "print_hooks::on_disconnect" << std::endl;
+    }
+};
+
 struct callable_int
 {
     void operator()( int i )
@@ -240,6 +267,23 @@ static void observer_disconnect_example()
     subject_void.notify();
 }
 
+static void scoped_connection_example()
+{
+    std::cout << "--- Scoped connection ---" << std::endl;
+
+    subject< int > subject_int;
+
+    {
+        scoped_connection connection( subject_int, free_function_int );
+
+        std::cout << "> subject< int >::notify( 42 )" << std::endl;
+        subject_int.notify( 42 );
+    }
+
+    std::cout << "> subject< int >::notify( 42 )" << std::endl;
+    subject_int.notify( 42 );
+}
+
 static void subject_blocker_example()
 {
     std::cout << "--- Subject blocker ---" << std::endl;
@@ -332,6 +376,113 @@ static void type_compatibility_example()
     subject_const_p_char.notify( const_p_char_value );
 }
 
+static void hook_policy_example()
+{
+    std::cout << "--- Hook policy ---" << std::endl;
+
+    basic_observer_owner< print_hooks > owner;
+    basic_subject< print_hooks, int >   subject_int;
+
+    std::cout << "> basic_observer_owner< print_hooks >::connect( subject_int, free_function_int )" << std::endl;
+    const auto handle = owner.connect( subject_int, free_function_int );
+
+    std::cout << "> basic_subject< print_hooks, int >::notify( 7 )" << std::endl;
+    subject_int.notify( 7 );
+
+    std::cout << "> basic_observer_owner< print_hooks >::disconnect( handle )" << std::endl;
+    owner.disconnect( handle );
+}
+
+static void replay_subject_example()
+{
+    std::cout << "--- Replay subject ---" << std::endl;
+
+    observer_owner           owner;
+    replay_subject< 2, int > subject_int;
+
+    std::cout << "> replay_subject< 2, int >::notify( 1 )" << std::endl;
+    subject_int.notify( 1 );
+    std::cout << "> replay_subject< 2, int >::notify( 2 )" << std::endl;
+    subject_int.notify( 2 );
+    std::cout << "> replay_subject< 2, int >::notify( 3 )" << std::endl;
+    subject_int.notify( 3 );
+
+    std::cout << "> observer_owner::connect( subject_int, free_function_int )" << std::endl;
+    owner.connect( subject_int, free_function_int );
+
+    std::cout << "> replay_subject< 2, int >::notify( 4 )" << std::endl;
+    subject_int.notify( 4 );
+}
+
+static void payload_example()
+{
+    std::cout << "--- Payload example ---" << std::endl;
+
+    observer_owner     owner;
+    payload_pool       pool( 1024 * 1024 );
+    subject< payload > subject_frame;
+
+    const auto frame_size = []( const payload &p ){ std::cout << "lambda( const payload & ) - size " << p.size() << ", use count " << p.use_count() << std::endl; };
+    const auto frame_data = []( const payload &p ){ std::cout << "lambda( const payload & ) - data '" << reinterpret_cast< const char * >( p.data() ) << "'" << std::endl; };
+
+    owner.connect( subject_frame, frame_size );
+    owner.connect( subject_frame, frame_data );
+
+    const char text[] = "Frame";
+    auto       frame  = pool.acquire( text, sizeof( text ) );
+
+    std::cout << "> subject< payload >::notify( frame )" << std::endl;
+    subject_frame.notify( frame );
+}
+
+static void journal_example()
+{
+    std::cout << "--- Journal example ---" << std::endl;
+
+    const char *path = "observer_demo.journal";
+
+    subject< int, char > subject_int_char;
+
+    {
+        async_file_writer    writer( path );
+        journal< int, char > journal_int_char( subject_int_char, writer );
+
+        std::cout << "> subject< int, char >::notify( 1, 'A' )" << std::endl;
+        subject_int_char.notify( 1, 'A' );
+        std::cout << "> subject< int, char >::notify( 2, 'B' )" << std::endl;
+        subject_int_char.notify( 2, 'B' );
+    }
+
+    observer_owner owner;
+    owner.connect( subject_int_char, []( int i, char c ){ std::cout << "lambda( int, char ) - " << i << ", " << c << std::endl; } );
+
+    std::cout << "> journal_reader< int, char >::replay( subject_int_char )" << std::endl;
+    journal_reader< int, char > reader( path );
+    reader.replay( subject_int_char );
+
+    std::remove( path );
+}
+
+static void window_aggregator_example()
+{
+    std::cout << "--- Window aggregator example ---" << std::endl;
+
+    observer_owner    owner;
+    subject< double > subject_double;
+    window_aggregator aggregator( subject_double, 3, 2 );
+
+    owner.connect( aggregator.updated, []( const window_stats &s )
+    {
+        std::cout << "lambda( const window_stats & ) - count " << s.count << ", mean " << s.mean() << ", min " << s.min << ", max " << s.max << std::endl;
+    } );
+
+    for( double d : { 1.0, 5.0, 3.0, 8.0 } )
+    {
+        std::cout << "> subject< double >::notify( " << d << " )" << std::endl;
+        subject_double.notify( d );
+    }
+}
+
 int main( int /* argc */, char * /* argv */[] )
 {
     free_function_observer_example();
@@ -343,8 +494,14 @@ int main( int /* argc */, char * /* argv */[] )
     observer_owner_lifetime_example();
     subject_lifetime_example();
     observer_disconnect_example();
+    scoped_connection_example();
     subject_blocker_example();
     type_compatibility_example();
+    hook_policy_example();
+    replay_subject_example();
+    payload_example();
+    journal_example();
+    window_aggregator_example();
 
     return 0;
 }
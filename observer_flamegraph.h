@@ -0,0 +1,397 @@
+// MIT License
+//
+// Copyright (c) 2017 PG1003
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "observer.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace pg
+{
+
+namespace pg_detail
+{
+
+// The names given to subjects and observers. Every distinct name gets an id, so
+// frames with the same name share a node. Threads keep a copy of the address to
+// id map and refresh it when the version changes, so a push does not take a lock.
+class flame_names
+{
+    std::mutex                                          m_mutex;
+    std::unordered_map< std::uintptr_t, std::uint32_t > m_ids;
+    std::unordered_map< std::string, std::uint32_t >    m_interned;
+    std::vector< std::string >                          m_names;
+    std::atomic< std::uint64_t >                        m_version = { 0 };
+
+public:
+    using id_map = std::unordered_map< std::uintptr_t, std::uint32_t >;
+
+    static flame_names & instance()
+    {
+        static auto names = new flame_names;
+        return *names;
+    }
+
+    void name( const void *id, std::string name )
+    {
+        for( auto &c : name )
+        {
+            c = c == ';' ? ':' : c;
+        }
+
+        std::lock_guard< std::mutex > lock( m_mutex );
+
+        const auto interned = m_interned.emplace( std::move( name ), static_cast< std::uint32_t >( m_names.size() ) );
+        if( interned.second )
+        {
+            m_names.push_back( interned.first->first );
+        }
+        m_ids[ reinterpret_cast< std::uintptr_t >( id ) ] = interned.first->second;
+        m_version.fetch_add( 1, std::memory_order_release );
+    }
+
+    std::uint64_t version() const noexcept
+    {
+        return m_version.load( std::memory_order_acquire );
+    }
+
+    // Copies the id map when it changed since 'version'.
+    void refresh( id_map &ids, std::uint64_t &version )
+    {
+        std::lock_guard< std::mutex > lock( m_mutex );
+
+        ids     = m_ids;
+        version = m_version.load( std::memory_order_relaxed );
+    }
+
+    std::vector< std::string > names()
+    {
+        std::lock_guard< std::mutex > lock( m_mutex );
+        return m_names;
+    }
+};
+
+// The dispatch stacks of one thread as a tree of frames. A frame is keyed by the
+// name of its subject or observer. Unnamed subjects are keyed by their address
+// and unnamed observers are collapsed into one frame, so connecting and
+// disconnecting observers does not grow the tree. Each node accumulates the time
+// spent in it, excluding the time spent in its children, so memory grows with
+// the number of distinct cascade chains, not with run time.
+//
+// Only the owning thread pushes and pops. It takes the lock only to add a node;
+// the times are atomics, so exporting them only locks out new nodes.
+class flame_profile
+{
+    using clock = std::chrono::steady_clock;
+
+public:
+    // The low two bits of a frame key tell what the rest of the key is.
+    static constexpr std::uintptr_t subject_frame  = 0;    // The subject's address.
+    static constexpr std::uintptr_t observer_frame = 1;    // Any unnamed observer.
+    static constexpr std::uintptr_t named_frame    = 2;    // A name id above the tag.
+
+private:
+    struct node
+    {
+        const std::uintptr_t                              frame;
+        const std::size_t                                 parent;
+        std::atomic< std::uint64_t >                      self_ns  = { 0 };
+        std::uint64_t                                     reset_ns = 0;    // Guarded by the mutex.
+        std::unordered_map< std::uintptr_t, std::size_t > children;        // Only used by the owning thread.
+
+        node( std::uintptr_t f, std::size_t p )
+                : frame( f )
+                , parent( p )
+        {}
+    };
+
+    std::mutex          m_mutex;
+    std::deque< node >  m_nodes;
+    std::size_t         m_current = 0;
+    clock::time_point   m_last;
+    flame_names::id_map m_ids;
+    std::uint64_t       m_ids_version = 0;
+
+    void charge( clock::time_point now ) noexcept
+    {
+        if( m_current != 0 )
+        {
+            auto &self_ns = m_nodes[ m_current ].self_ns;
+            self_ns.store( self_ns.load( std::memory_order_relaxed ) + static_cast< std::uint64_t >( std::chrono::duration_cast< std::chrono::nanoseconds >( now - m_last ).count() ), std::memory_order_relaxed );
+        }
+        m_last = now;
+    }
+
+    std::uintptr_t key( const void *id, bool observer )
+    {
+        const auto version = flame_names::instance().version();
+        if( version != m_ids_version )
+        {
+            flame_names::instance().refresh( m_ids, m_ids_version );
+        }
+
+        const auto name = m_ids.find( reinterpret_cast< std::uintptr_t >( id ) );
+        if( name != m_ids.end() )
+        {
+            return std::uintptr_t( name->second ) << 2 | named_frame;
+        }
+
+        return observer ? observer_frame : reinterpret_cast< std::uintptr_t >( id );
+    }
+
+public:
+    flame_profile()
+    {
+        m_nodes.emplace_back( 0, 0 );
+    }
+
+    void push( const void *id, bool observer )
+    {
+        const auto now   = clock::now();
+        const auto frame = key( id, observer );
+
+        charge( now );
+
+        auto &children = m_nodes[ m_current ].children;
+        auto it        = children.find( frame );
+        if( it == children.end() )
+        {
+            std::lock_guard< std::mutex > lock( m_mutex );
+
+            it = children.emplace( frame, m_nodes.size() ).first;
+            m_nodes.emplace_back( frame, m_current );
+        }
+        m_current = it->second;
+    }
+
+    void pop() noexcept
+    {
+        charge( clock::now() );
+        m_current = m_nodes[ m_current ].parent;
+    }
+
+    void reset() noexcept
+    {
+        std::lock_guard< std::mutex > lock( m_mutex );
+
+        for( auto &n : m_nodes )
+        {
+            n.reset_ns = n.self_ns.load( std::memory_order_relaxed );
+        }
+    }
+
+    // Calls f( frames, self_ns ) for every stack with recorded time.
+    template< typename F >
+    void for_each_stack( F f )
+    {
+        std::lock_guard< std::mutex > lock( m_mutex );
+
+        std::vector< std::uintptr_t > frames;
+        for( std::size_t i = 1; i < m_nodes.size(); ++i )
+        {
+            const auto ns = m_nodes[ i ].self_ns.load( std::memory_order_relaxed ) - m_nodes[ i ].reset_ns;
+            if( ns == 0 )
+            {
+                continue;
+            }
+
+            frames.clear();
+            for( auto n = i; n != 0; n = m_nodes[ n ].parent )
+            {
+                frames.push_back( m_nodes[ n ].frame );
+            }
+            f( frames, ns );
+        }
+    }
+};
+
+class flame_registry
+{
+    std::mutex                                      m_mutex;
+    std::vector< std::shared_ptr< flame_profile > > m_profiles;
+
+public:
+    static flame_registry & instance()
+    {
+        static auto registry = new flame_registry;
+        return *registry;
+    }
+
+    // The profile of the calling thread; it outlives the thread so its samples
+    // are still exported after the thread exits.
+    static flame_profile & local()
+    {
+        thread_local std::shared_ptr< flame_profile > profile = instance().add();
+        return *profile;
+    }
+
+    std::shared_ptr< flame_profile > add()
+    {
+        auto profile = std::make_shared< flame_profile >();
+
+        std::lock_guard< std::mutex > lock( m_mutex );
+        m_profiles.push_back( profile );
+
+        return profile;
+    }
+
+    std::string folded()
+    {
+        const auto names = flame_names::instance().names();
+
+        std::lock_guard< std::mutex > lock( m_mutex );
+
+        std::unordered_map< std::string, std::uint64_t > stacks;
+        std::string                                       stack;
+        for( auto &p : m_profiles )
+        {
+            p->for_each_stack( [ & ]( const std::vector< std::uintptr_t > &frames, std::uint64_t ns )
+            {
+                stack.clear();
+                for( auto it = frames.rbegin(); it != frames.rend(); ++it )
+                {
+                    if( !stack.empty() )
+                    {
+                        stack += ';';
+                    }
+
+                    switch( *it & 3 )
+                    {
+                    case flame_profile::named_frame:
+                        stack += names[ *it >> 2 ];
+                        break;
+                    case flame_profile::observer_frame:
+                        stack += "observer";
+                        break;
+                    default:
+                        char text[ 32 ];
+                        std::snprintf( text, sizeof( text ), "subject@%p", reinterpret_cast< const void * >( *it ) );
+                        stack += text;
+                        break;
+                    }
+                }
+                stacks[ stack ] += ns;
+            } );
+        }
+
+        std::string out;
+        for( const auto &s : stacks )
+        {
+            out += s.first;
+            out += ' ';
+            out += std::to_string( s.second );
+            out += '\n';
+        }
+
+        return out;
+    }
+
+    void reset()
+    {
+        std::lock_guard< std::mutex > lock( m_mutex );
+        for( auto &p : m_profiles )
+        {
+            p->reset();
+        }
+    }
+};
+
+}
+
+// Hook policy that aggregates the time spent in notifications into folded
+// stacks of nested subjects and observers. Use it for the subjects of interest,
+// e.g. basic_subject< flamegraph_hooks, A... >, and render the result with
+// flamegraph::folded(); the count of a stack is its exclusive time in nanoseconds.
+struct flamegraph_hooks : no_hooks
+{
+    static void on_notify_begin( const void *subject, std::size_t /* observers */ )
+    {
+        pg_detail::flame_registry::local().push( subject, false );
+    }
+
+    static void on_notify_end( const void * /* subject */ ) noexcept
+    {
+        pg_detail::flame_registry::local().pop();
+    }
+
+    static void on_invoke_begin( const void * /* subject */, const observer_handle *observer )
+    {
+        pg_detail::flame_registry::local().push( observer, true );
+    }
+
+    static void on_invoke_end( const void * /* subject */, const observer_handle * /* observer */ ) noexcept
+    {
+        pg_detail::flame_registry::local().pop();
+    }
+};
+
+namespace flamegraph
+{
+
+// Names a subject or an observer handle in the output. Frames with the same name
+// are merged. Unnamed subjects are shown by their address and unnamed observers
+// as 'observer'.
+inline void name( const void *id, std::string name )
+{
+    pg_detail::flame_names::instance().name( id, std::move( name ) );
+}
+
+// The collected stacks in the 'frame;frame;frame count' format of flamegraph.pl.
+inline std::string folded()
+{
+    return pg_detail::flame_registry::instance().folded();
+}
+
+inline bool write_folded( const std::string &path )
+{
+    const auto text = folded();
+
+    auto f = std::fopen( path.c_str(), "wb" );
+    if( !f )
+    {
+        return false;
+    }
+
+    const bool written = std::fwrite( text.data(), 1, text.size(), f ) == text.size();
+
+    return std::fclose( f ) == 0 && written;
+}
+
+inline void reset()
+{
+    pg_detail::flame_registry::instance().reset();
+}
+
+}
+
+}
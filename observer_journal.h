@@ -0,0 +1,1028 @@
+// MIT License
+//
+// Copyright (c) 2017 PG1003
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "observer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if !defined( PG_OBSERVER_NO_IO_URING ) && __has_include( <linux/io_uring.h> )
+#define PG_OBSERVER_IO_URING 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+
+namespace pg
+{
+
+enum class async_writer_backend
+{
+    automatic,
+    io_uring,
+    pwritev
+};
+
+namespace pg_detail
+{
+
+struct write_batch
+{
+    std::vector< char > data;
+    std::uint64_t       offset  = 0;
+    std::size_t         written = 0;
+    iovec               iov     = {};
+};
+
+// Writes a batch synchronously on the writer thread. A batch that is submitted
+// without an error is returned by a later reap.
+class pwritev_backend
+{
+    int                         m_fd;
+    std::deque< write_batch * > m_completed;
+
+public:
+    explicit pwritev_backend( int fd ) noexcept
+            : m_fd( fd )
+    {}
+
+    int submit( write_batch *b ) noexcept
+    {
+        while( b->written < b->data.size() )
+        {
+            b->iov.iov_base = b->data.data() + b->written;
+            b->iov.iov_len  = b->data.size() - b->written;
+
+            const auto res = ::pwritev( m_fd, &b->iov, 1, static_cast< off_t >( b->offset + b->written ) );
+            if( res < 0 )
+            {
+                if( errno == EINTR )
+                {
+                    continue;
+                }
+                return errno;
+            }
+            if( res == 0 )
+            {
+                return EIO;
+            }
+            b->written += static_cast< std::size_t >( res );
+        }
+        m_completed.push_back( b );
+
+        return 0;
+    }
+
+    write_batch * reap( bool /* wait */, int &error ) noexcept
+    {
+        error = 0;
+        if( m_completed.empty() )
+        {
+            return nullptr;
+        }
+        auto b = m_completed.front();
+        m_completed.pop_front();
+
+        return b;
+    }
+};
+
+#if defined( PG_OBSERVER_IO_URING )
+
+// A minimal io_uring submission/completion ring driven by the raw system calls so
+// no liburing is required. Only the writer thread touches the rings.
+class io_uring_backend
+{
+    int          m_fd        = -1;
+    int          m_ring_fd   = -1;
+    void         *m_sq_ptr   = MAP_FAILED;
+    void         *m_cq_ptr   = MAP_FAILED;
+    std::size_t  m_sq_size   = 0;
+    std::size_t  m_cq_size   = 0;
+    io_uring_sqe *m_sqes     = static_cast< io_uring_sqe * >( MAP_FAILED );
+    std::size_t  m_sqes_size = 0;
+    unsigned     *m_sq_tail  = nullptr;
+    unsigned     *m_sq_mask  = nullptr;
+    unsigned     *m_sq_array = nullptr;
+    unsigned     *m_cq_head  = nullptr;
+    unsigned     *m_cq_tail  = nullptr;
+    unsigned     *m_cq_mask  = nullptr;
+    io_uring_cqe *m_cqes     = nullptr;
+
+    static int enter( int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags ) noexcept
+    {
+        return static_cast< int >( ::syscall( __NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0 ) );
+    }
+
+public:
+    io_uring_backend( int fd, unsigned entries ) noexcept
+            : m_fd( fd )
+    {
+        io_uring_params params = {};
+
+        m_ring_fd = static_cast< int >( ::syscall( __NR_io_uring_setup, entries, &params ) );
+        if( m_ring_fd < 0 )
+        {
+            return;
+        }
+
+        m_sq_size = params.sq_off.array + params.sq_entries * sizeof( unsigned );
+        m_cq_size = params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe );
+        if( params.features & IORING_FEAT_SINGLE_MMAP )
+        {
+            m_sq_size = m_cq_size = std::max( m_sq_size, m_cq_size );
+        }
+
+        m_sq_ptr = ::mmap( nullptr, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQ_RING );
+        if( m_sq_ptr == MAP_FAILED )
+        {
+            return;
+        }
+        if( params.features & IORING_FEAT_SINGLE_MMAP )
+        {
+            m_cq_ptr = m_sq_ptr;
+        }
+        else
+        {
+            m_cq_ptr = ::mmap( nullptr, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_CQ_RING );
+            if( m_cq_ptr == MAP_FAILED )
+            {
+                return;
+            }
+        }
+
+        m_sqes_size = params.sq_entries * sizeof( io_uring_sqe );
+        m_sqes      = static_cast< io_uring_sqe * >( ::mmap( nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ring_fd, IORING_OFF_SQES ) );
+        if( m_sqes == MAP_FAILED )
+        {
+            return;
+        }
+
+        auto sq    = static_cast< char * >( m_sq_ptr );
+        auto cq    = static_cast< char * >( m_cq_ptr );
+        m_sq_tail  = reinterpret_cast< unsigned * >( sq + params.sq_off.tail );
+        m_sq_mask  = reinterpret_cast< unsigned * >( sq + params.sq_off.ring_mask );
+        m_sq_array = reinterpret_cast< unsigned * >( sq + params.sq_off.array );
+        m_cq_head  = reinterpret_cast< unsigned * >( cq + params.cq_off.head );
+        m_cq_tail  = reinterpret_cast< unsigned * >( cq + params.cq_off.tail );
+        m_cq_mask  = reinterpret_cast< unsigned * >( cq + params.cq_off.ring_mask );
+        m_cqes     = reinterpret_cast< io_uring_cqe * >( cq + params.cq_off.cqes );
+    }
+
+    io_uring_backend( const io_uring_backend & )             = delete;
+    io_uring_backend & operator=( const io_uring_backend & ) = delete;
+
+    ~io_uring_backend() noexcept
+    {
+        if( m_sqes != MAP_FAILED )
+        {
+            ::munmap( m_sqes, m_sqes_size );
+        }
+        if( m_cq_ptr != MAP_FAILED && m_cq_ptr != m_sq_ptr )
+        {
+            ::munmap( m_cq_ptr, m_cq_size );
+        }
+        if( m_sq_ptr != MAP_FAILED )
+        {
+            ::munmap( m_sq_ptr, m_sq_size );
+        }
+        if( m_ring_fd >= 0 )
+        {
+            ::close( m_ring_fd );
+        }
+    }
+
+    bool valid() const noexcept
+    {
+        return m_cqes != nullptr;
+    }
+
+    int submit( write_batch *b ) noexcept
+    {
+        b->iov.iov_base = b->data.data() + b->written;
+        b->iov.iov_len  = b->data.size() - b->written;
+
+        const unsigned tail  = *m_sq_tail;
+        const unsigned index = tail & *m_sq_mask;
+        auto           &sqe  = m_sqes[ index ];
+
+        std::memset( &sqe, 0, sizeof( sqe ) );
+        sqe.opcode    = IORING_OP_WRITEV;
+        sqe.fd        = m_fd;
+        sqe.addr      = reinterpret_cast< std::uint64_t >( &b->iov );
+        sqe.len       = 1;
+        sqe.off       = b->offset + b->written;
+        sqe.user_data = reinterpret_cast< std::uint64_t >( b );
+
+        m_sq_array[ index ] = index;
+        __atomic_store_n( m_sq_tail, tail + 1, __ATOMIC_RELEASE );
+
+        while( enter( m_ring_fd, 1, 0, 0 ) < 0 )
+        {
+            if( errno != EINTR && errno != EAGAIN && errno != EBUSY )
+            {
+                // Take the entry back, so the kernel does not write from the
+                // batch after the caller has reused it.
+                const int error = errno;
+                __atomic_store_n( m_sq_tail, tail, __ATOMIC_RELEASE );
+                return error;
+            }
+        }
+
+        return 0;
+    }
+
+    write_batch * reap( bool wait, int &error ) noexcept
+    {
+        for( ;; )
+        {
+            const unsigned head = *m_cq_head;
+            if( head == __atomic_load_n( m_cq_tail, __ATOMIC_ACQUIRE ) )
+            {
+                if( !wait )
+                {
+                    error = 0;
+                    return nullptr;
+                }
+                enter( m_ring_fd, 0, 1, IORING_ENTER_GETEVENTS );
+                continue;
+            }
+
+            const auto cqe = m_cqes[ head & *m_cq_mask ];
+            __atomic_store_n( m_cq_head, head + 1, __ATOMIC_RELEASE );
+
+            auto b = reinterpret_cast< write_batch * >( cqe.user_data );
+            if( cqe.res < 0 )
+            {
+                error = -cqe.res;
+                return b;
+            }
+
+            // A write that made no progress would never complete, so it fails the
+            // batch instead of losing the rest of it.
+            if( cqe.res == 0 && b->written < b->data.size() )
+            {
+                error = EIO;
+                return b;
+            }
+
+            // Resubmit the remainder of a short write; the batch completes once all of it is on disk.
+            b->written += static_cast< std::size_t >( cqe.res );
+            if( b->written < b->data.size() )
+            {
+                error = submit( b );
+                if( error )
+                {
+                    return b;
+                }
+                continue;
+            }
+
+            error = 0;
+            return b;
+        }
+    }
+};
+
+#endif
+
+}
+
+// Appends bytes to a file without blocking the calling thread on I/O.
+// write() copies into a staging buffer; a writer thread hands full buffers to
+// io_uring (or to pwritev when io_uring is unavailable) and reaps completions,
+// so a notifying thread only pays for a short critical section and a memcpy.
+// When the disk falls behind, write() blocks once 'max_staged' bytes wait in
+// the staging buffer, so memory use stays bounded.
+class async_file_writer
+{
+    using clock = std::chrono::steady_clock;
+
+    int                                     m_fd;
+    const std::size_t                       m_batch_size;
+    const std::size_t                       m_max_staged;
+    const clock::duration                   m_flush_interval;
+    async_writer_backend                    m_backend = async_writer_backend::pwritev;
+    std::mutex                              m_mutex;
+    std::condition_variable                 m_wake;
+    std::condition_variable                 m_flushed;
+    std::condition_variable                 m_staged;
+    std::vector< char >                     m_staging;
+    std::vector< pg_detail::write_batch >   m_batches;
+    std::vector< pg_detail::write_batch * > m_free;
+    std::uint64_t                           m_offset    = 0;
+    std::uint64_t                           m_requested = 0;
+    std::uint64_t                           m_completed = 0;    // All bytes before this offset are written.
+    bool                                    m_stop      = false;
+
+    // Batches that completed ahead of an earlier batch, as [offset, end) ranges.
+    std::priority_queue< std::pair< std::uint64_t, std::uint64_t >,
+                         std::vector< std::pair< std::uint64_t, std::uint64_t > >,
+                         std::greater<> >   m_completed_ahead;
+    std::atomic< int >                      m_error     = { 0 };
+    std::thread                             m_thread;
+
+    void complete( pg_detail::write_batch *b )
+    {
+        std::lock_guard< std::mutex > lock( m_mutex );
+
+        // io_uring may complete batches out of order; only the contiguous prefix counts as written.
+        m_completed_ahead.emplace( b->offset, b->offset + b->data.size() );
+        while( !m_completed_ahead.empty() && m_completed_ahead.top().first <= m_completed )
+        {
+            m_completed = std::max( m_completed, m_completed_ahead.top().second );
+            m_completed_ahead.pop();
+        }
+        b->data.clear();
+        m_free.push_back( b );
+        m_flushed.notify_all();
+    }
+
+    template< typename BACKEND >
+    void run( BACKEND &backend )
+    {
+        std::size_t in_flight = 0;
+
+        for( ;; )
+        {
+            pg_detail::write_batch *b = nullptr;
+            {
+                std::unique_lock< std::mutex > lock( m_mutex );
+
+                const auto ready = [ this ]
+                {
+                    return m_stop || m_staging.size() >= m_batch_size || m_requested > m_offset;
+                };
+
+                // Small writes are left to accumulate while earlier batches are in flight
+                // or until the flush interval expires.
+                if( in_flight == 0 )
+                {
+                    m_wake.wait_for( lock, m_flush_interval, ready );
+                }
+                if( m_stop && m_staging.empty() && in_flight == 0 )
+                {
+                    return;
+                }
+                if( !m_staging.empty() && !m_free.empty() && ( in_flight == 0 || ready() ) )
+                {
+                    b = m_free.back();
+                    m_free.pop_back();
+                    b->data.swap( m_staging );
+                    b->offset  = m_offset;
+                    b->written = 0;
+                    m_offset  += b->data.size();
+                    m_staged.notify_all();
+                }
+            }
+
+            if( b )
+            {
+                if( const int error = backend.submit( b ) )
+                {
+                    m_error.store( error, std::memory_order_relaxed );
+                    complete( b );
+                    b = nullptr;
+                }
+                else
+                {
+                    ++in_flight;
+                }
+            }
+
+            // Only block on completions when there is nothing to submit or every batch
+            // is in flight; otherwise go back to collecting writes.
+            int  error = 0;
+            bool wait  = b == nullptr;
+            while( in_flight > 0 )
+            {
+                auto done = backend.reap( wait || in_flight == m_batches.size(), error );
+                if( !done )
+                {
+                    break;
+                }
+                if( error )
+                {
+                    m_error.store( error, std::memory_order_relaxed );
+                }
+                wait = false;
+                --in_flight;
+                complete( done );
+            }
+        }
+    }
+
+public:
+    explicit async_file_writer( const std::string &path,
+                                async_writer_backend backend = async_writer_backend::automatic,
+                                std::size_t batch_size = 64 * 1024,
+                                std::size_t max_in_flight = 4,
+                                std::chrono::milliseconds flush_interval = std::chrono::milliseconds( 10 ),
+                                std::size_t max_staged = 0 )
+            : m_fd( ::open( path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 ) )
+            , m_batch_size( batch_size )
+            , m_max_staged( std::max( max_staged ? max_staged : 4 * batch_size, batch_size ) )
+            , m_flush_interval( flush_interval )
+            , m_batches( max_in_flight ? max_in_flight : 1 )
+    {
+        if( m_fd < 0 )
+        {
+            throw std::system_error( errno, std::generic_category(), path );
+        }
+
+        m_staging.reserve( m_batch_size );
+        for( auto &b : m_batches )
+        {
+            b.data.reserve( m_batch_size );
+            m_free.push_back( &b );
+        }
+
+#if defined( PG_OBSERVER_IO_URING )
+        if( backend != async_writer_backend::pwritev )
+        {
+            auto ring = std::make_unique< pg_detail::io_uring_backend >( m_fd, static_cast< unsigned >( m_batches.size() ) );
+            if( ring->valid() )
+            {
+                m_backend = async_writer_backend::io_uring;
+                m_thread  = std::thread( [ this, ring = std::move( ring ) ]{ run( *ring ); } );
+                return;
+            }
+        }
+#else
+        ( void )backend;
+#endif
+
+        m_thread = std::thread( [ this ]
+        {
+            pg_detail::pwritev_backend fallback( m_fd );
+            run( fallback );
+        } );
+    }
+
+    async_file_writer( const async_file_writer & )             = delete;
+    async_file_writer & operator=( const async_file_writer & ) = delete;
+
+    ~async_file_writer() noexcept
+    {
+        {
+            std::lock_guard< std::mutex > lock( m_mutex );
+            m_stop = true;
+        }
+        m_wake.notify_one();
+        m_thread.join();
+        ::close( m_fd );
+    }
+
+    async_writer_backend backend() const noexcept { return m_backend; }
+
+    std::error_code error() const noexcept
+    {
+        return std::error_code( m_error.load( std::memory_order_relaxed ), std::generic_category() );
+    }
+
+    void write( const void *data, std::size_t size )
+    {
+        bool wake;
+        {
+            std::unique_lock< std::mutex > lock( m_mutex );
+
+            // A write larger than the cap is accepted into an empty buffer.
+            m_staged.wait( lock, [ this, size ]{ return m_staging.empty() || m_staging.size() + size <= m_max_staged; } );
+
+            const auto p = static_cast< const char * >( data );
+            m_staging.insert( m_staging.end(), p, p + size );
+            wake = m_staging.size() >= m_batch_size && m_staging.size() - size < m_batch_size;
+        }
+        if( wake )
+        {
+            m_wake.notify_one();
+        }
+    }
+
+    // Blocks until everything written so far has completed.
+    void flush()
+    {
+        std::unique_lock< std::mutex > lock( m_mutex );
+
+        const auto target = m_offset + m_staging.size();
+        m_requested       = std::max( m_requested, target );
+        m_wake.notify_one();
+        m_flushed.wait( lock, [ this, target ]{ return m_completed >= target; } );
+    }
+};
+
+namespace pg_detail
+{
+
+template< typename ...A >
+struct journal_record
+{
+    static_assert( ( std::is_trivially_copyable_v< std::decay_t< A > > && ... ), "Journaled values must be trivially copyable" );
+
+    static constexpr std::size_t size = ( std::size_t( 0 ) + ... + sizeof( std::decay_t< A > ) );
+};
+
+}
+
+// Journals every notification of a subject to an async_file_writer. A record is
+// the raw bytes of the notification values in argument order.
+template< typename ...A >
+class journal : private observer_owner
+{
+public:
+    journal( subject< A... > &s, async_file_writer &writer )
+    {
+        connect( s, [ &writer ]( A... args )
+        {
+            char        record[ pg_detail::journal_record< A... >::size + 1 ];
+            std::size_t pos = 0;
+
+            ( ( std::memcpy( record + pos, &args, sizeof( std::decay_t< A > ) ), pos += sizeof( std::decay_t< A > ) ), ... );
+            writer.write( record, pos );
+        } );
+    }
+};
+
+// Reads a journal written by pg::journal and notifies its records to a subject.
+template< typename ...A >
+class journal_reader
+{
+    std::ifstream m_file;
+
+public:
+    explicit journal_reader( const std::string &path )
+            : m_file( path, std::ios::binary )
+    {}
+
+    bool is_open() const noexcept { return m_file.is_open(); }
+
+    // Notifies the next record; returns false at the end of the journal.
+    bool replay_one( subject< A... > &s )
+    {
+        char record[ pg_detail::journal_record< A... >::size + 1 ];
+
+        if( !m_file.read( record, pg_detail::journal_record< A... >::size ) )
+        {
+            return false;
+        }
+
+        std::tuple< std::decay_t< A >... > values;
+        std::size_t                        pos = 0;
+
+        std::apply( [ & ]( auto &...v )
+        {
+            ( ( std::memcpy( &v, record + pos, sizeof( v ) ), pos += sizeof( v ) ), ... );
+        }, values );
+        std::apply( [ &s ]( auto &...v ){ s.notify( v... ); }, values );
+
+        return true;
+    }
+
+    std::size_t replay( subject< A... > &s )
+    {
+        std::size_t count = 0;
+        while( replay_one( s ) )
+        {
+            ++count;
+        }
+
+        return count;
+    }
+};
+
+namespace pg_detail
+{
+
+inline void put_varint( std::vector< char > &out, std::uint64_t v )
+{
+    while( v >= 0x80 )
+    {
+        out.push_back( static_cast< char >( v | 0x80 ) );
+        v >>= 7;
+    }
+    out.push_back( static_cast< char >( v ) );
+}
+
+inline bool get_varint( const char *&p, const char *end, std::uint64_t &v ) noexcept
+{
+    if( p != end && !( *p & 0x80 ) )
+    {
+        v = static_cast< std::uint8_t >( *p++ );
+        return true;
+    }
+
+    v = 0;
+    for( unsigned shift = 0; p != end && shift < 64; shift += 7 )
+    {
+        const auto byte = static_cast< std::uint8_t >( *p++ );
+        v |= std::uint64_t( byte & 0x7F ) << shift;
+        if( !( byte & 0x80 ) )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+constexpr std::uint64_t zigzag( std::uint64_t delta ) noexcept
+{
+    return ( delta << 1 ) ^ ( 0 - ( delta >> 63 ) );
+}
+
+constexpr std::uint64_t unzigzag( std::uint64_t v ) noexcept
+{
+    return ( v >> 1 ) ^ ( 0 - ( v & 1 ) );
+}
+
+// Integers, enums and floating point values are stored as the zigzag varint of
+// the difference between their bit patterns and those of the previous record;
+// small price or id steps therefore take one or two bytes. Any other trivially
+// copyable value is stored as a 'same as previous' byte or the raw value.
+template< typename T >
+struct field_codec
+{
+    static constexpr bool is_numeric = std::is_integral_v< T > || std::is_enum_v< T > || std::is_floating_point_v< T >;
+
+    static std::uint64_t to_bits( const T &v ) noexcept
+    {
+        if constexpr( std::is_enum_v< T > )
+        {
+            return field_codec< std::underlying_type_t< T > >::to_bits( static_cast< std::underlying_type_t< T > >( v ) );
+        }
+        else if constexpr( std::is_floating_point_v< T > )
+        {
+            using bits_type = std::conditional_t< sizeof( T ) == 4, std::uint32_t, std::uint64_t >;
+            static_assert( sizeof( T ) == sizeof( bits_type ), "Unsupported floating point size" );
+
+            bits_type bits;
+            std::memcpy( &bits, &v, sizeof( v ) );
+            return bits;
+        }
+        else if constexpr( std::is_signed_v< T > )
+        {
+            return static_cast< std::uint64_t >( static_cast< std::int64_t >( v ) );
+        }
+        else
+        {
+            return static_cast< std::uint64_t >( v );
+        }
+    }
+
+    static T from_bits( std::uint64_t bits ) noexcept
+    {
+        if constexpr( std::is_enum_v< T > )
+        {
+            return static_cast< T >( field_codec< std::underlying_type_t< T > >::from_bits( bits ) );
+        }
+        else if constexpr( std::is_floating_point_v< T > )
+        {
+            using bits_type = std::conditional_t< sizeof( T ) == 4, std::uint32_t, std::uint64_t >;
+
+            const auto narrow = static_cast< bits_type >( bits );
+            T          v;
+            std::memcpy( &v, &narrow, sizeof( v ) );
+            return v;
+        }
+        else if constexpr( std::is_same_v< T, bool > )
+        {
+            return bits != 0;
+        }
+        else
+        {
+            return static_cast< T >( bits );
+        }
+    }
+
+    static void encode( std::vector< char > &out, const T &value, T &previous )
+    {
+        if constexpr( is_numeric )
+        {
+            put_varint( out, zigzag( to_bits( value ) - to_bits( previous ) ) );
+        }
+        else if( std::memcmp( &value, &previous, sizeof( T ) ) == 0 )
+        {
+            out.push_back( 0 );
+        }
+        else
+        {
+            out.push_back( 1 );
+            out.insert( out.end(), reinterpret_cast< const char * >( &value ), reinterpret_cast< const char * >( &value ) + sizeof( T ) );
+        }
+        previous = value;
+    }
+
+    static bool decode( const char *&p, const char *end, T &previous ) noexcept
+    {
+        if constexpr( is_numeric )
+        {
+            std::uint64_t v;
+            if( !get_varint( p, end, v ) )
+            {
+                return false;
+            }
+            previous = from_bits( to_bits( previous ) + unzigzag( v ) );
+        }
+        else
+        {
+            if( p == end )
+            {
+                return false;
+            }
+            if( *p++ )
+            {
+                if( static_cast< std::size_t >( end - p ) < sizeof( T ) )
+                {
+                    return false;
+                }
+                std::memcpy( &previous, p, sizeof( T ) );
+                p += sizeof( T );
+            }
+        }
+        return true;
+    }
+};
+
+// A compressed journal is a sequence of blocks. Each block starts with this
+// header and its first record is a keyframe, encoded against value initialized
+// fields, so a reader can start decoding at any block.
+struct compressed_block_header
+{
+    std::uint32_t size;
+    std::uint32_t records;
+};
+
+}
+
+// Journals every notification of a subject in the compressed format. Records are
+// buffered per block and a block is handed to the writer once 'keyframe_interval'
+// records are encoded or when the journal is destroyed.
+// Notifications of the journaled subject must not be emitted concurrently.
+template< typename ...A >
+class compressed_journal : private observer_owner
+{
+    using values_type = std::tuple< std::decay_t< A >... >;
+
+    static_assert( ( std::is_trivially_copyable_v< std::decay_t< A > > && ... ), "Journaled values must be trivially copyable" );
+
+    async_file_writer   &m_writer;
+    const std::uint32_t m_keyframe_interval;
+    std::vector< char > m_block;
+    std::uint32_t       m_records = 0;
+    values_type         m_previous;
+
+    void write_block()
+    {
+        if( m_records == 0 )
+        {
+            return;
+        }
+
+        const pg_detail::compressed_block_header header = { static_cast< std::uint32_t >( m_block.size() - sizeof( header ) ), m_records };
+        std::memcpy( m_block.data(), &header, sizeof( header ) );
+        m_writer.write( m_block.data(), m_block.size() );
+
+        m_block.resize( sizeof( header ) );
+        m_records  = 0;
+        m_previous = values_type();
+    }
+
+    void record( const std::decay_t< A > &...args )
+    {
+        std::apply( [ & ]( auto &...previous )
+        {
+            ( pg_detail::field_codec< std::decay_t< A > >::encode( m_block, args, previous ), ... );
+        }, m_previous );
+
+        if( ++m_records == m_keyframe_interval )
+        {
+            write_block();
+        }
+    }
+
+public:
+    compressed_journal( subject< A... > &s, async_file_writer &writer, std::uint32_t keyframe_interval = 256 )
+            : m_writer( writer )
+            , m_keyframe_interval( keyframe_interval ? keyframe_interval : 1 )
+            , m_block( sizeof( pg_detail::compressed_block_header ) )
+            , m_previous()
+    {
+        connect( s, [ this ]( A... args ){ record( args... ); } );
+    }
+
+    ~compressed_journal() noexcept
+    {
+        write_block();
+    }
+};
+
+// Reads a journal written by pg::compressed_journal. seek() hops over block
+// headers to the keyframe in front of the requested record, so random access
+// only decodes the records of one block.
+template< typename ...A >
+class compressed_journal_reader
+{
+    using values_type = std::tuple< std::decay_t< A >... >;
+
+    struct block_index
+    {
+        std::streamoff offset;
+        std::size_t    first_record;
+    };
+
+    std::ifstream              m_file;
+    std::vector< block_index > m_index;
+    std::vector< char >        m_block;
+    const char                 *m_pos       = nullptr;
+    std::uint32_t              m_remaining  = 0;
+    std::size_t                m_next_block = 0;
+    values_type                m_values;
+
+    // Indexes the block headers the first time random access is needed.
+    void build_index()
+    {
+        if( !m_index.empty() )
+        {
+            return;
+        }
+
+        m_file.clear();
+        m_file.seekg( 0 );
+
+        std::size_t                        records = 0;
+        pg_detail::compressed_block_header header;
+        for( std::streamoff offset = 0; m_file.read( reinterpret_cast< char * >( &header ), sizeof( header ) ); )
+        {
+            m_index.push_back( { offset, records } );
+            records += header.records;
+            offset  += static_cast< std::streamoff >( sizeof( header ) + header.size );
+            m_file.seekg( offset );
+        }
+        m_index.push_back( { -1, records } );
+        m_file.clear();
+    }
+
+    bool load_block( std::size_t block )
+    {
+        if( !m_index.empty() )
+        {
+            if( block + 1 >= m_index.size() )
+            {
+                return false;
+            }
+            m_file.clear();
+            m_file.seekg( m_index[ block ].offset );
+        }
+
+        pg_detail::compressed_block_header header;
+        if( !m_file.read( reinterpret_cast< char * >( &header ), sizeof( header ) ) )
+        {
+            return false;
+        }
+
+        m_block.resize( header.size );
+        if( !m_file.read( m_block.data(), header.size ) )
+        {
+            return false;
+        }
+
+        m_pos        = m_block.data();
+        m_remaining  = header.records;
+        m_next_block = block + 1;
+        m_values     = values_type();
+
+        return true;
+    }
+
+    bool decode_one()
+    {
+        while( m_remaining == 0 )
+        {
+            if( !load_block( m_next_block ) )
+            {
+                return false;
+            }
+        }
+
+        const char *end = m_block.data() + m_block.size();
+        const bool ok   = std::apply( [ & ]( auto &...values )
+        {
+            return ( pg_detail::field_codec< std::decay_t< A > >::decode( m_pos, end, values ) && ... );
+        }, m_values );
+
+        --m_remaining;
+
+        return ok;
+    }
+
+public:
+    explicit compressed_journal_reader( const std::string &path )
+            : m_file( path, std::ios::binary )
+            , m_values()
+    {}
+
+    bool is_open() const noexcept { return m_file.is_open(); }
+
+    // Total number of records; indexes the journal on first use.
+    std::size_t size()
+    {
+        build_index();
+        return m_index.back().first_record;
+    }
+
+    // Positions the reader so that the next replayed record is 'record'.
+    bool seek( std::size_t record )
+    {
+        build_index();
+
+        auto it = std::upper_bound( m_index.begin(), m_index.end() - 1, record, []( std::size_t r, const block_index &b )
+        {
+            return r < b.first_record;
+        } );
+        if( it == m_index.begin() || record >= m_index.back().first_record )
+        {
+            return false;
+        }
+        --it;
+
+        if( !load_block( static_cast< std::size_t >( it - m_index.begin() ) ) )
+        {
+            return false;
+        }
+        for( auto skip = record - it->first_record; skip > 0; --skip )
+        {
+            if( !decode_one() )
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Notifies the next record; returns false at the end of the journal.
+    bool replay_one( subject< A... > &s )
+    {
+        if( !decode_one() )
+        {
+            return false;
+        }
+
+        std::apply( [ &s ]( auto &...v ){ s.notify( v... ); }, m_values );
+
+        return true;
+    }
+
+    std::size_t replay( subject< A... > &s )
+    {
+        std::size_t count = 0;
+        while( replay_one( s ) )
+        {
+            ++count;
+        }
+
+        return count;
+    }
+};
+
+}
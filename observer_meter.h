@@ -0,0 +1,277 @@
+// MIT License
+//
+// Copyright (c) 2017 PG1003
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Notification metering, included by observer.h when PG_OBSERVER_METERING is
+// defined. A subject that is instrumented then gets a subject_meter that counts
+// notifications and observer invocations with relaxed atomics and records notify
+// durations; reading the rates is the only place that takes a lock. Subjects
+// that are not instrumented only carry a null pointer.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+namespace pg
+{
+
+struct meter_rates
+{
+    double per_1s  = 0.0;
+    double per_10s = 0.0;
+    double per_60s = 0.0;
+};
+
+// Counts events and derives exponentially weighted moving averages of the event
+// rate over 1, 10 and 60 seconds. The averages advance when they are read, using
+// the time elapsed since the previous read.
+class rate_meter
+{
+    using clock = std::chrono::steady_clock;
+
+    std::atomic< std::uint64_t > m_count = { 0 };
+
+    mutable std::mutex        m_mutex;
+    mutable clock::time_point m_last_tick  = clock::now();
+    mutable std::uint64_t     m_last_count = 0;
+    mutable meter_rates       m_rates;
+
+public:
+    rate_meter() noexcept = default;
+
+    rate_meter( const rate_meter & ) noexcept
+            : rate_meter()
+    {}
+
+    rate_meter & operator=( const rate_meter & ) noexcept
+    {
+        return *this;
+    }
+
+    void mark( std::uint64_t n = 1 ) noexcept
+    {
+        m_count.fetch_add( n, std::memory_order_relaxed );
+    }
+
+    std::uint64_t count() const noexcept
+    {
+        return m_count.load( std::memory_order_relaxed );
+    }
+
+    meter_rates rates() const
+    {
+        std::lock_guard< std::mutex > lock( m_mutex );
+
+        const auto now     = clock::now();
+        const auto elapsed = std::chrono::duration< double >( now - m_last_tick ).count();
+        if( elapsed > 0.0 )
+        {
+            const auto count   = m_count.load( std::memory_order_relaxed );
+            const auto instant = static_cast< double >( count - m_last_count ) / elapsed;
+            const auto update  = [ & ]( double &rate, double seconds )
+            {
+                rate += ( 1.0 - std::exp( -elapsed / seconds ) ) * ( instant - rate );
+            };
+
+            update( m_rates.per_1s, 1.0 );
+            update( m_rates.per_10s, 10.0 );
+            update( m_rates.per_60s, 60.0 );
+            m_last_tick  = now;
+            m_last_count = count;
+        }
+
+        return m_rates;
+    }
+};
+
+// Distribution of notify durations in fixed, exponentially growing buckets.
+// The buckets are separate relaxed counters, so a reader sees every bucket
+// monotonically increasing without blocking the notifying threads.
+class latency_histogram
+{
+public:
+    static constexpr std::size_t bucket_count = 12;
+
+    // Upper bounds of the buckets in nanoseconds; the last bucket is unbounded.
+    static constexpr std::uint64_t bounds[ bucket_count - 1 ] =
+    {
+        100, 250, 500, 1000, 2500, 5000, 10000, 25000, 100000, 1000000, 10000000
+    };
+
+    struct snapshot
+    {
+        std::uint64_t buckets[ bucket_count ] = {};
+        std::uint64_t sum_ns                  = 0;
+    };
+
+private:
+    std::atomic< std::uint64_t > m_buckets[ bucket_count ] = {};
+    std::atomic< std::uint64_t > m_sum_ns                  = { 0 };
+
+public:
+    latency_histogram() noexcept = default;
+
+    latency_histogram( const latency_histogram & ) noexcept
+            : latency_histogram()
+    {}
+
+    latency_histogram & operator=( const latency_histogram & ) noexcept
+    {
+        return *this;
+    }
+
+    void record( std::uint64_t ns ) noexcept
+    {
+        const auto bucket = static_cast< std::size_t >( std::lower_bound( std::begin( bounds ), std::end( bounds ), ns ) - std::begin( bounds ) );
+
+        m_buckets[ bucket ].fetch_add( 1, std::memory_order_relaxed );
+        m_sum_ns.fetch_add( ns, std::memory_order_relaxed );
+    }
+
+    snapshot read() const noexcept
+    {
+        snapshot s;
+        for( std::size_t i = 0; i < bucket_count; ++i )
+        {
+            s.buckets[ i ] = m_buckets[ i ].load( std::memory_order_relaxed );
+        }
+        s.sum_ns = m_sum_ns.load( std::memory_order_relaxed );
+
+        return s;
+    }
+};
+
+class subject_meter;
+
+// The subject meters that are instrumented with a name.
+class meter_registry
+{
+    std::mutex                           m_mutex;
+    std::vector< const subject_meter * > m_meters;
+
+public:
+    static meter_registry & instance()
+    {
+        // Never destroyed, so subjects with static storage duration can still unregister at exit.
+        static auto registry = new meter_registry;
+        return *registry;
+    }
+
+    void add( const subject_meter *m )
+    {
+        std::lock_guard< std::mutex > lock( m_mutex );
+        m_meters.push_back( m );
+    }
+
+    void remove( const subject_meter *m ) noexcept
+    {
+        std::lock_guard< std::mutex > lock( m_mutex );
+        m_meters.erase( std::remove( m_meters.begin(), m_meters.end(), m ), m_meters.end() );
+    }
+
+    // Calls f for each registered meter. Meters can not unregister while this runs.
+    template< typename F >
+    void for_each( F f )
+    {
+        std::lock_guard< std::mutex > lock( m_mutex );
+        for( auto m : m_meters )
+        {
+            f( *m );
+        }
+    }
+};
+
+class subject_meter
+{
+    using clock = std::chrono::steady_clock;
+
+    rate_meter                 m_notifications;
+    rate_meter                 m_invocations;
+    latency_histogram          m_latency;
+    std::atomic< std::size_t > m_observers  = { 0 };
+    std::string                m_name;
+    std::atomic< bool >        m_registered = { false };
+
+public:
+    subject_meter() noexcept = default;
+
+    // A copied subject does not inherit the meter's counts or registration.
+    subject_meter( const subject_meter & ) noexcept
+            : subject_meter()
+    {}
+
+    subject_meter & operator=( const subject_meter & ) noexcept
+    {
+        return *this;
+    }
+
+    ~subject_meter() noexcept
+    {
+        if( m_registered.load( std::memory_order_relaxed ) )
+        {
+            meter_registry::instance().remove( this );
+        }
+    }
+
+    // Names the meter and registers it so that it can be enumerated by dashboards.
+    void instrument( std::string name )
+    {
+        m_name = std::move( name );
+        if( !m_registered.load( std::memory_order_relaxed ) )
+        {
+            meter_registry::instance().add( this );
+            m_registered.store( true, std::memory_order_relaxed );
+        }
+    }
+
+    clock::time_point begin_notify( std::size_t observers ) noexcept
+    {
+        m_notifications.mark();
+        m_invocations.mark( observers );
+
+        return clock::now();
+    }
+
+    void end_notify( clock::time_point start ) noexcept
+    {
+        m_latency.record( static_cast< std::uint64_t >( std::chrono::duration_cast< std::chrono::nanoseconds >( clock::now() - start ).count() ) );
+    }
+
+    void observer_added( std::size_t n = 1 ) noexcept { m_observers.fetch_add( n, std::memory_order_relaxed ); }
+    void observer_removed( std::size_t n = 1 ) noexcept { m_observers.fetch_sub( n, std::memory_order_relaxed ); }
+
+    const std::string & name() const noexcept { return m_name; }
+    std::size_t observers() const noexcept { return m_observers.load( std::memory_order_relaxed ); }
+    const rate_meter & notifications() const noexcept { return m_notifications; }
+    const rate_meter & invocations() const noexcept { return m_invocations; }
+    const latency_histogram & latency() const noexcept { return m_latency; }
+};
+
+}
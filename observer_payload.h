@@ -0,0 +1,256 @@
+// MIT License
+//
+// Copyright (c) 2017 PG1003
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+
+namespace pg
+{
+
+namespace pg_detail
+{
+
+struct payload_pool_state;
+
+// Header in front of every block's data. The data starts at the next multiple
+// of 'payload_alignment' so that large frames are cache line aligned.
+struct payload_block
+{
+    std::atomic< std::size_t > refs;
+    payload_pool_state         *pool;
+    std::size_t                size;
+    payload_block              *next_free;
+};
+
+constexpr std::size_t payload_alignment   = 64;
+constexpr std::size_t payload_header_size = ( sizeof( payload_block ) + payload_alignment - 1 ) & ~( payload_alignment - 1 );
+
+// Shared between the pool and its outstanding blocks. The pool itself holds one
+// reference and each acquired block holds one, so a pool may be destroyed while
+// payloads are still in flight; the memory is released when the last one returns.
+struct payload_pool_state
+{
+    struct chunk_deleter
+    {
+        void operator()( std::byte *p ) const noexcept
+        {
+            ::operator delete( p, std::align_val_t( payload_alignment ) );
+        }
+    };
+
+    const std::size_t                                            block_capacity;
+    const std::size_t                                            block_stride;
+    const std::size_t                                            blocks_per_chunk;
+    std::atomic< std::size_t >                                   refs = { 1 };
+    std::mutex                                                   mutex;
+    payload_block                                                *free_list = nullptr;
+    std::vector< std::unique_ptr< std::byte[], chunk_deleter > > chunks;
+
+    payload_pool_state( std::size_t capacity, std::size_t per_chunk )
+            : block_capacity( capacity )
+            , block_stride( payload_header_size + ( ( capacity + payload_alignment - 1 ) & ~( payload_alignment - 1 ) ) )
+            , blocks_per_chunk( per_chunk ? per_chunk : 1 )
+    {}
+
+    void release_ref() noexcept
+    {
+        if( refs.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+        {
+            delete this;
+        }
+    }
+
+    payload_block * acquire()
+    {
+        std::lock_guard< std::mutex > lock( mutex );
+
+        if( !free_list )
+        {
+            auto raw = static_cast< std::byte * >( ::operator new( block_stride * blocks_per_chunk, std::align_val_t( payload_alignment ) ) );
+            chunks.emplace_back( raw );
+
+            // Thread the new blocks in address order so that consecutive acquires walk forward through the chunk.
+            for( std::size_t i = blocks_per_chunk; i-- > 0; )
+            {
+                auto b    = ::new( raw + i * block_stride ) payload_block{ { 0 }, this, 0, free_list };
+                free_list = b;
+            }
+        }
+
+        auto b    = free_list;
+        free_list = b->next_free;
+        b->refs.store( 1, std::memory_order_relaxed );
+        b->size   = 0;
+
+        refs.fetch_add( 1, std::memory_order_relaxed );
+
+        return b;
+    }
+
+    void release( payload_block *b ) noexcept
+    {
+        {
+            std::lock_guard< std::mutex > lock( mutex );
+
+            b->next_free = free_list;
+            free_list    = b;
+        }
+        release_ref();
+    }
+};
+
+}
+
+// A reference counted handle to a fixed capacity block owned by a payload_pool.
+// Copying a payload copies the handle, not the data, so a subject< pg::payload >
+// hands the same buffer to every observer. The block returns to its pool when
+// the last handle that refers to it is destroyed.
+class payload
+{
+    friend class payload_pool;
+
+    pg_detail::payload_block *m_block = nullptr;
+
+    explicit payload( pg_detail::payload_block *b ) noexcept
+            : m_block( b )
+    {}
+
+public:
+    payload() noexcept = default;
+
+    payload( const payload &other ) noexcept
+            : m_block( other.m_block )
+    {
+        if( m_block )
+        {
+            m_block->refs.fetch_add( 1, std::memory_order_relaxed );
+        }
+    }
+
+    payload( payload &&other ) noexcept
+            : m_block( std::exchange( other.m_block, nullptr ) )
+    {}
+
+    payload & operator=( payload other ) noexcept
+    {
+        std::swap( m_block, other.m_block );
+        return *this;
+    }
+
+    ~payload() noexcept
+    {
+        if( m_block && m_block->refs.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+        {
+            m_block->pool->release( m_block );
+        }
+    }
+
+    explicit operator bool() const noexcept { return m_block != nullptr; }
+
+    std::uint8_t * data() noexcept
+    {
+        return m_block ? reinterpret_cast< std::uint8_t * >( m_block ) + pg_detail::payload_header_size : nullptr;
+    }
+
+    const std::uint8_t * data() const noexcept
+    {
+        return m_block ? reinterpret_cast< const std::uint8_t * >( m_block ) + pg_detail::payload_header_size : nullptr;
+    }
+
+    std::uint8_t * begin() noexcept { return data(); }
+    std::uint8_t * end() noexcept { return data() + size(); }
+    const std::uint8_t * begin() const noexcept { return data(); }
+    const std::uint8_t * end() const noexcept { return data() + size(); }
+
+    std::size_t size() const noexcept { return m_block ? m_block->size : 0; }
+    std::size_t capacity() const noexcept { return m_block ? m_block->pool->block_capacity : 0; }
+
+    // Sets the number of valid bytes. The size is clamped to the block's capacity.
+    void resize( std::size_t size ) noexcept
+    {
+        if( m_block )
+        {
+            m_block->size = size < capacity() ? size : capacity();
+        }
+    }
+
+    std::size_t use_count() const noexcept
+    {
+        return m_block ? m_block->refs.load( std::memory_order_relaxed ) : 0;
+    }
+};
+
+// Recycles fixed capacity blocks for large notification payloads.
+// Blocks are carved out of chunks of 'blocks_per_chunk' blocks; chunks are kept
+// until the pool and all payloads acquired from it are destroyed.
+class payload_pool
+{
+    pg_detail::payload_pool_state *m_state;
+
+public:
+    explicit payload_pool( std::size_t block_capacity, std::size_t blocks_per_chunk = 8 )
+            : m_state( new pg_detail::payload_pool_state( block_capacity, blocks_per_chunk ) )
+    {}
+
+    payload_pool( const payload_pool & )             = delete;
+    payload_pool & operator=( const payload_pool & ) = delete;
+
+    ~payload_pool() noexcept
+    {
+        m_state->release_ref();
+    }
+
+    std::size_t block_capacity() const noexcept { return m_state->block_capacity; }
+
+    payload acquire()
+    {
+        return payload( m_state->acquire() );
+    }
+
+    // Throws std::length_error when the data does not fit in a block.
+    payload acquire( const void *data, std::size_t size )
+    {
+        if( size > block_capacity() )
+        {
+            throw std::length_error( "payload_pool::acquire: data is larger than the block capacity" );
+        }
+
+        auto p = acquire();
+        p.resize( size );
+        std::memcpy( p.data(), data, p.size() );
+
+        return p;
+    }
+};
+
+}
@@ -0,0 +1,203 @@
+// MIT License
+//
+// Copyright (c) 2017 PG1003
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Renders the meters of the instrumented subjects in the Prometheus text
+// exposition format. Subjects are only metered when PG_OBSERVER_METERING is
+// defined before observer.h is included.
+
+#pragma once
+
+#include "observer_meter.h"
+
+#include <cstdio>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+
+namespace pg
+{
+
+namespace pg_detail
+{
+
+struct subject_meter_snapshot
+{
+    std::string                 name;
+    std::uint64_t               notifications;
+    std::uint64_t               invocations;
+    std::size_t                 observers;
+    meter_rates                 notify_rates;
+    latency_histogram::snapshot latency;
+};
+
+inline void append_label_value( std::string &out, const std::string &value )
+{
+    for( char c : value )
+    {
+        switch( c )
+        {
+        case '\\': out += "\\\\"; break;
+        case '"':  out += "\\\""; break;
+        case '\n': out += "\\n";  break;
+        default:   out += c;      break;
+        }
+    }
+}
+
+template< typename T >
+void append_sample( std::string &out, const char *metric, const std::string &subject, const char *extra_label, const char *extra_value, T value )
+{
+    out += metric;
+    out += "{subject=\"";
+    append_label_value( out, subject );
+    out += '"';
+    if( extra_label )
+    {
+        out += ',';
+        out += extra_label;
+        out += "=\"";
+        out += extra_value;
+        out += '"';
+    }
+    out += "} ";
+    if constexpr( std::is_floating_point_v< T > )
+    {
+        char text[ 32 ];
+        std::snprintf( text, sizeof( text ), "%.17g", value );
+        out += text;
+    }
+    else
+    {
+        out += std::to_string( value );
+    }
+    out += '\n';
+}
+
+inline void append_header( std::string &out, const char *metric, const char *type, const char *help )
+{
+    out += "# HELP ";
+    out += metric;
+    out += ' ';
+    out += help;
+    out += "\n# TYPE ";
+    out += metric;
+    out += ' ';
+    out += type;
+    out += '\n';
+}
+
+}
+
+// Takes a snapshot of all registered meters and renders it. Only registration
+// is blocked while the snapshot is taken; notifying threads keep running.
+inline std::string render_prometheus()
+{
+    using namespace pg_detail;
+
+    std::vector< subject_meter_snapshot > snapshots;
+    meter_registry::instance().for_each( [ &snapshots ]( const subject_meter &m )
+    {
+        snapshots.push_back( { m.name(),
+                               m.notifications().count(),
+                               m.invocations().count(),
+                               m.observers(),
+                               m.notifications().rates(),
+                               m.latency().read() } );
+    } );
+
+    std::string out;
+
+    append_header( out, "pg_observer_notifications_total", "counter", "Notifications emitted by the subject." );
+    for( const auto &s : snapshots )
+    {
+        append_sample( out, "pg_observer_notifications_total", s.name, nullptr, nullptr, s.notifications );
+    }
+
+    append_header( out, "pg_observer_invocations_total", "counter", "Observer invocations caused by the subject's notifications." );
+    for( const auto &s : snapshots )
+    {
+        append_sample( out, "pg_observer_invocations_total", s.name, nullptr, nullptr, s.invocations );
+    }
+
+    append_header( out, "pg_observer_observers", "gauge", "Observers connected to the subject." );
+    for( const auto &s : snapshots )
+    {
+        append_sample( out, "pg_observer_observers", s.name, nullptr, nullptr, s.observers );
+    }
+
+    append_header( out, "pg_observer_notify_rate", "gauge", "Exponentially weighted moving average of notifications per second." );
+    for( const auto &s : snapshots )
+    {
+        append_sample( out, "pg_observer_notify_rate", s.name, "window", "1s", s.notify_rates.per_1s );
+        append_sample( out, "pg_observer_notify_rate", s.name, "window", "10s", s.notify_rates.per_10s );
+        append_sample( out, "pg_observer_notify_rate", s.name, "window", "60s", s.notify_rates.per_60s );
+    }
+
+    // The count is the sum of the bucket counts that were read, so the histogram
+    // is consistent with itself even while notifications are recorded.
+    append_header( out, "pg_observer_notify_duration_seconds", "histogram", "Duration of the subject's notify calls." );
+    for( const auto &s : snapshots )
+    {
+        std::uint64_t cumulative = 0;
+        for( std::size_t i = 0; i < latency_histogram::bucket_count; ++i )
+        {
+            cumulative += s.latency.buckets[ i ];
+
+            char bound[ 32 ] = "+Inf";
+            if( i + 1 < latency_histogram::bucket_count )
+            {
+                std::snprintf( bound, sizeof( bound ), "%g", static_cast< double >( latency_histogram::bounds[ i ] ) * 1e-9 );
+            }
+            append_sample( out, "pg_observer_notify_duration_seconds_bucket", s.name, "le", bound, cumulative );
+        }
+        append_sample( out, "pg_observer_notify_duration_seconds_sum", s.name, nullptr, nullptr, static_cast< double >( s.latency.sum_ns ) * 1e-9 );
+        append_sample( out, "pg_observer_notify_duration_seconds_count", s.name, nullptr, nullptr, cumulative );
+    }
+
+    return out;
+}
+
+// Writes the rendered metrics to a temporary file that is renamed over 'path',
+// so a scraper never reads a partially written file.
+inline bool write_prometheus( const std::string &path )
+{
+    const auto text = render_prometheus();
+    const auto tmp  = path + ".tmp";
+
+    auto f = std::fopen( tmp.c_str(), "wb" );
+    if( !f )
+    {
+        return false;
+    }
+
+    const bool written = std::fwrite( text.data(), 1, text.size(), f ) == text.size();
+    if( std::fclose( f ) != 0 || !written )
+    {
+        std::remove( tmp.c_str() );
+        return false;
+    }
+
+    return std::rename( tmp.c_str(), path.c_str() ) == 0;
+}
+
+}
@@ -0,0 +1,347 @@
+// Regression tests for the observer library and its add-ons. Build it like the
+// demo and run it; it prints the failed checks and exits with 1 on failure.
+
+#include "observer.h"
+#include "observer_flamegraph.h"
+#include "observer_payload.h"
+#include "observer_window.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+using namespace pg;
+
+static int failures = 0;
+
+#define CHECK( condition ) \
+    do \
+    { \
+        if( !( condition ) ) \
+        { \
+            std::printf( "%s:%d: CHECK( %s ) failed\n", __FILE__, __LINE__, #condition ); \
+            ++failures; \
+        } \
+    } \
+    while( false )
+
+
+static void payload_acquire_larger_than_block()
+{
+    payload_pool              pool( 16 );
+    const std::vector< char > data( 17, 'x' );
+
+    bool thrown = false;
+    try
+    {
+        pool.acquire( data.data(), data.size() );
+    }
+    catch( const std::length_error & )
+    {
+        thrown = true;
+    }
+    CHECK( thrown );
+
+    const auto p = pool.acquire( data.data(), 16 );
+    CHECK( p.size() == 16 );
+}
+
+static void replay_exception_leaves_observer_disconnected()
+{
+    replay_subject< 2, int > s;
+    observer_owner           owner;
+    int                      calls = 0;
+
+    s.notify( 1 );
+
+    bool thrown = false;
+    try
+    {
+        owner.connect( s, []( int ){ throw std::runtime_error( "replay" ); } );
+    }
+    catch( const std::runtime_error & )
+    {
+        thrown = true;
+    }
+    CHECK( thrown );
+
+    const auto c = owner.connect( s, [ &calls ]( int ){ ++calls; } );
+    CHECK( calls == 1 );
+    CHECK( owner.handle( c ) != nullptr );
+
+    s.notify( 2 );
+    CHECK( calls == 2 );
+}
+
+static void replay_records_notify_through_base()
+{
+    replay_subject< 2, int > s;
+    subject< int >          &base = s;
+    observer_owner           owner;
+    std::vector< int >       seen;
+
+    base.notify( 1 );
+    base.notify( 2 );
+    base.notify( 3 );
+    CHECK( s.history_size() == 2 );
+
+    owner.connect( s, [ &seen ]( int v ){ seen.push_back( v ); } );
+    CHECK( ( seen == std::vector< int >{ 2, 3 } ) );
+
+    replay_subject< 2, int >       copy( s );
+    observer_owner                 other;
+    int                            replayed = 0;
+
+    other.connect( copy, [ &replayed ]( int ){ ++replayed; } );
+    CHECK( replayed == 2 );
+}
+
+static void window_percentiles_and_default_emit()
+{
+    subject< double > s;
+    window_aggregator aggregator( s, 100 );
+    observer_owner    owner;
+    window_stats      stats;
+    int               emitted = 0;
+
+    owner.connect( aggregator.updated, [ & ]( const window_stats &w ){ stats = w; ++emitted; } );
+
+    for( int i = 1; i <= 200; ++i )
+    {
+        s.notify( static_cast< double >( i ) );
+    }
+
+    // Once per window length by default.
+    CHECK( emitted == 2 );
+    CHECK( stats.count == 100 );
+    CHECK( std::fabs( stats.p50 - 150.0 ) <= 150.0 * 0.02 );
+    CHECK( std::fabs( stats.p90 - 190.0 ) <= 190.0 * 0.02 );
+    CHECK( std::fabs( stats.p99 - 199.0 ) <= 199.0 * 0.02 );
+    CHECK( stats.p50 <= stats.p90 && stats.p90 <= stats.p99 );
+}
+
+static void flamegraph_collapses_unnamed_observers()
+{
+    basic_subject< flamegraph_hooks, int >   s;
+    basic_observer_owner< flamegraph_hooks > owner;
+
+    flamegraph::name( &s, "churn" );
+    for( int i = 0; i < 100; ++i )
+    {
+        const auto c = owner.connect( s, []( int ){} );
+        s.notify( i );
+        owner.disconnect( c );
+    }
+
+    const auto folded = flamegraph::folded();
+    CHECK( folded.find( "churn;observer " ) != std::string::npos );
+    CHECK( std::count( folded.begin(), folded.end(), '\n' ) <= 2 );
+    flamegraph::reset();
+}
+
+template< typename S >
+static void destructor_disconnects_from_same_subject()
+{
+    struct guard
+    {
+        scoped_connection connection;
+    };
+
+    int calls = 0;
+    {
+        observer_owner owner;
+        S              s;
+
+        auto g        = std::make_shared< guard >();
+        g->connection = scoped_connection( s, [ &calls ]( int ){ ++calls; } );
+
+        const auto c = owner.connect( s, [ g ]( int ){} );
+        owner.connect( s, [ &calls ]( int ){ calls += 10; } );
+        g.reset();
+
+        // Destroying the second observer disconnects the first one.
+        owner.disconnect( c );
+        s.notify( 0 );
+        CHECK( calls == 10 );
+
+        g             = std::make_shared< guard >();
+        g->connection = scoped_connection( s, [ &calls ]( int ){ ++calls; } );
+        owner.connect( s, [ g ]( int ){} );
+        g.reset();
+    }
+    CHECK( calls == 10 );
+}
+
+static void compact_subject_single_and_many_observers()
+{
+    compact_subject< int > s;
+    observer_owner         owner;
+    int                    sum = 0;
+
+    const auto first = owner.connect( s, [ &sum ]( int i ){ sum += i; } );
+    s.notify( 1 );
+    CHECK( sum == 1 );
+
+    const auto second = owner.connect( s, [ &sum ]( int i ){ sum += 10 * i; } );
+    s.notify( 1 );
+    CHECK( sum == 12 );
+
+    owner.disconnect( first );
+    owner.suspend( second );
+    s.notify( 1 );
+    CHECK( sum == 12 );
+
+    owner.resume( second );
+    owner.disconnect_all( s );
+    CHECK( s.observer_count() == 0 );
+
+    owner.connect( s, [ &sum ]( int i ){ sum += 100 * i; } );
+    s.notify( 1 );
+    CHECK( sum == 112 );
+}
+
+template< typename S >
+static void owner_teardown_with_reentrant_destructor()
+{
+    struct guard
+    {
+        scoped_connection connection;
+    };
+
+    int calls = 0;
+    S   s;
+    {
+        observer_owner owner;
+
+        auto g        = std::make_shared< guard >();
+        g->connection = scoped_connection( s, [ &calls ]( int ){ ++calls; } );
+        owner.connect( s, [ g ]( int ){} );
+        owner.connect( s, [ &calls ]( int ){ calls += 10; } );
+        g.reset();
+
+        // Destroying the first observer of the owner disconnects the scoped connection.
+        owner.disconnect_all( s );
+        s.notify( 0 );
+        CHECK( calls == 0 );
+
+        g             = std::make_shared< guard >();
+        g->connection = scoped_connection( s, [ &calls ]( int ){ ++calls; } );
+        owner.connect( s, [ g ]( int ){} );
+        owner.connect( s, [ &calls ]( int ){ calls += 10; } );
+        g.reset();
+    }
+    s.notify( 0 );
+    CHECK( calls == 0 );
+}
+
+template< typename S >
+static void slots_follow_erase_and_compaction()
+{
+    S                                s;
+    observer_owner                   owner;
+    observer_owner                   other;
+    std::vector< scoped_connection > scoped;
+    int                              sum = 0;
+
+    for( int i = 0; i < 4; ++i )
+    {
+        scoped.emplace_back( s, [ &sum, i ]( int ){ sum += 1 << i; } );
+        other.connect( s, []( int ){} );
+    }
+    const auto c = owner.connect( s, [ &sum ]( int ){ sum += 100; } );
+
+    scoped[ 1 ].disconnect();
+    other.disconnect_all( s );
+    scoped[ 0 ].suspend();
+    s.notify( 0 );
+    CHECK( sum == 4 + 8 + 100 );
+
+    scoped[ 0 ].resume();
+    scoped[ 3 ].disconnect();
+    owner.disconnect( c );
+    sum = 0;
+    s.notify( 0 );
+    CHECK( sum == 1 + 4 );
+}
+
+static void group_observer_invalidates_its_group()
+{
+    connection_group group;
+    subject< int >   s;
+    subject< int >   other;
+    int              calls = 0;
+
+    auto reconnect = std::make_shared< int >( 0 );
+    group.connect( s, [ &, reconnect ]( int )
+    {
+        ++calls;
+        group.invalidate();
+        group.connect( other, [ &calls ]( int ){ calls += 10; } );
+        ++*reconnect;
+    } );
+
+    // The running observer survives the invalidate and the connect.
+    s.notify( 0 );
+    CHECK( calls == 1 );
+    CHECK( *reconnect == 1 );
+
+    s.notify( 0 );
+    other.notify( 0 );
+    CHECK( calls == 11 );
+
+    group.reclaim();
+    CHECK( reconnect.use_count() == 1 );
+}
+
+static void observer_invalidates_group_during_notify()
+{
+    connection_group       group;
+    observer_owner         owner;
+    compact_subject< int > s;
+    int                    calls = 0;
+
+    owner.connect( s, [ &group ]( int ){ group.invalidate(); } );
+    for( int i = 0; i < 1000; ++i )
+    {
+        group.connect( s, [ &calls ]( int ){ ++calls; } );
+    }
+
+    // The group's observers after the invalidating one are skipped, not freed.
+    s.notify( 0 );
+    CHECK( calls == 0 );
+    CHECK( s.observer_count() == 1001 );
+
+    group.reclaim();
+    CHECK( s.observer_count() == 1 );
+}
+
+int main( int /* argc */, char * /* argv */[] )
+{
+    payload_acquire_larger_than_block();
+    replay_exception_leaves_observer_disconnected();
+    replay_records_notify_through_base();
+    window_percentiles_and_default_emit();
+    flamegraph_collapses_unnamed_observers();
+    compact_subject_single_and_many_observers();
+    destructor_disconnects_from_same_subject< subject< int > >();
+    destructor_disconnects_from_same_subject< compact_subject< int > >();
+    owner_teardown_with_reentrant_destructor< subject< int > >();
+    owner_teardown_with_reentrant_destructor< compact_subject< int > >();
+    slots_follow_erase_and_compaction< subject< int > >();
+    slots_follow_erase_and_compaction< compact_subject< int > >();
+    group_observer_invalidates_its_group();
+    observer_invalidates_group_during_notify();
+
+    if( failures )
+    {
+        std::printf( "%d check(s) failed\n", failures );
+        return 1;
+    }
+
+    std::printf( "All checks passed\n" );
+    return 0;
+}
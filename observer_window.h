@@ -0,0 +1,309 @@
+// MIT License
+//
+// Copyright (c) 2017 PG1003
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "observer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+
+namespace pg
+{
+
+struct window_stats
+{
+    std::size_t count = 0;
+    double      sum   = 0.0;
+    double      min   = 0.0;
+    double      max   = 0.0;
+    double      p50   = 0.0;
+    double      p90   = 0.0;
+    double      p99   = 0.0;
+
+    double mean() const noexcept { return count ? sum / static_cast< double >( count ) : 0.0; }
+};
+
+namespace pg_detail
+{
+
+// Logarithmically bucketed counts with a relative error of about 1% for
+// magnitudes between 1e-9 and 1e12; smaller magnitudes count as zero and larger
+// ones go to the outermost buckets. Adding and removing a value is O(1), the
+// quantiles are found in one walk over the buckets.
+class quantile_histogram
+{
+    static constexpr double accuracy      = 0.01;
+    static constexpr double min_magnitude = 1e-9;
+    static constexpr double max_magnitude = 1e12;
+
+    const double                 m_gamma     = ( 1.0 + accuracy ) / ( 1.0 - accuracy );
+    const double                 m_log_gamma = std::log( m_gamma );
+    const int                    m_buckets   = static_cast< int >( std::ceil( std::log( max_magnitude / min_magnitude ) / m_log_gamma ) ) + 1;
+    std::vector< std::uint32_t > m_counts    = std::vector< std::uint32_t >( 2 * static_cast< std::size_t >( m_buckets ) + 1 );
+
+    double bucket_value( int bucket ) const noexcept
+    {
+        const int  magnitude_bucket = bucket < m_buckets ? m_buckets - 1 - bucket : bucket - m_buckets - 1;
+        const auto magnitude        = min_magnitude * 2.0 * std::pow( m_gamma, magnitude_bucket ) / ( m_gamma + 1.0 );
+
+        return bucket == m_buckets ? 0.0 : bucket < m_buckets ? -magnitude : magnitude;
+    }
+
+public:
+    // Buckets are ordered by value: negative values from large to small magnitude, zero, positive values.
+    int bucket( double value ) const noexcept
+    {
+        const auto magnitude = std::fabs( value );
+        if( !( magnitude >= min_magnitude ) )
+        {
+            return m_buckets;
+        }
+
+        const auto i = std::min( static_cast< int >( std::ceil( std::log( magnitude / min_magnitude ) / m_log_gamma ) ), m_buckets - 1 );
+
+        return value < 0.0 ? m_buckets - 1 - i : m_buckets + 1 + i;
+    }
+
+    void add( int bucket ) noexcept { ++m_counts[ static_cast< std::size_t >( bucket ) ]; }
+    void remove( int bucket ) noexcept { --m_counts[ static_cast< std::size_t >( bucket ) ]; }
+
+    // Fills 'values' with the quantiles 'q', which must be in ascending order,
+    // in one walk over the buckets.
+    void quantiles( const double *q, double *values, std::size_t n, std::size_t count ) const noexcept
+    {
+        std::size_t j    = 0;
+        std::size_t seen = 0;
+        for( std::size_t i = 0; i < m_counts.size() && j < n && count; ++i )
+        {
+            seen += m_counts[ i ];
+            while( j < n && seen > static_cast< std::size_t >( q[ j ] * static_cast< double >( count - 1 ) ) )
+            {
+                values[ j++ ] = bucket_value( static_cast< int >( i ) );
+            }
+        }
+        for( ; j < n; ++j )
+        {
+            values[ j ] = count ? bucket_value( static_cast< int >( m_counts.size() ) - 1 ) : 0.0;
+        }
+    }
+};
+
+}
+
+// Subscribes once to a numeric subject and maintains count, sum, min, max and
+// approximate percentiles over a sliding window. The window is either the last
+// N samples or the samples of the last period of time. Each sample is added and
+// expired in O(1) amortized time; min and max are kept in monotonic queues.
+// The aggregate is emitted on 'updated' every 'emit_every' samples for a count
+// window, by default once per window length, or on the first sample after
+// 'emit_interval' elapsed for a time window. Emitting walks the histogram, so
+// emitting on every sample costs far more than adding it.
+template< typename CLOCK = std::chrono::steady_clock >
+class basic_window_aggregator : private observer_owner
+{
+public:
+    using clock      = CLOCK;
+    using time_point = typename clock::time_point;
+    using duration   = typename clock::duration;
+
+    subject< const window_stats & > updated;
+
+private:
+    struct sample
+    {
+        double        value;
+        time_point    time;
+        std::uint64_t sequence;
+        int           bucket;
+    };
+
+    struct extreme
+    {
+        double        value;
+        std::uint64_t sequence;
+    };
+
+    const std::size_t             m_window_samples = 0;
+    const duration                m_window_period  = duration::zero();
+    const std::size_t             m_emit_every     = 0;
+    const duration                m_emit_interval  = duration::zero();
+    std::deque< sample >          m_samples;
+    std::deque< extreme >         m_min;
+    std::deque< extreme >         m_max;
+    pg_detail::quantile_histogram m_histogram;
+    double                        m_sum            = 0.0;
+    double                        m_compensation   = 0.0;
+    std::uint64_t                 m_sequence       = 0;
+    std::size_t                   m_since_emit     = 0;
+    time_point                    m_last_emit      = clock::now();
+
+    // Neumaier summation keeps the running sum from drifting as samples are added and subtracted.
+    void accumulate( double value ) noexcept
+    {
+        const auto t = m_sum + value;
+        m_compensation += std::fabs( m_sum ) >= std::fabs( value ) ? ( m_sum - t ) + value : ( value - t ) + m_sum;
+        m_sum           = t;
+    }
+
+    void expire_front()
+    {
+        const auto &s = m_samples.front();
+
+        accumulate( -s.value );
+        m_histogram.remove( s.bucket );
+        if( m_min.front().sequence == s.sequence )
+        {
+            m_min.pop_front();
+        }
+        if( m_max.front().sequence == s.sequence )
+        {
+            m_max.pop_front();
+        }
+        m_samples.pop_front();
+
+        if( m_samples.empty() )
+        {
+            m_sum          = 0.0;
+            m_compensation = 0.0;
+        }
+    }
+
+    void expire( time_point now )
+    {
+        if( m_window_samples )
+        {
+            while( m_samples.size() > m_window_samples )
+            {
+                expire_front();
+            }
+        }
+        else
+        {
+            while( !m_samples.empty() && now - m_samples.front().time > m_window_period )
+            {
+                expire_front();
+            }
+        }
+    }
+
+    void add( double value )
+    {
+        const auto now = m_window_samples ? time_point() : clock::now();
+        const auto seq = m_sequence++;
+
+        m_samples.push_back( { value, now, seq, m_histogram.bucket( value ) } );
+        m_histogram.add( m_samples.back().bucket );
+        accumulate( value );
+
+        while( !m_min.empty() && m_min.back().value >= value )
+        {
+            m_min.pop_back();
+        }
+        m_min.push_back( { value, seq } );
+        while( !m_max.empty() && m_max.back().value <= value )
+        {
+            m_max.pop_back();
+        }
+        m_max.push_back( { value, seq } );
+
+        expire( now );
+
+        ++m_since_emit;
+        if( m_emit_every ? m_since_emit >= m_emit_every : now - m_last_emit >= m_emit_interval )
+        {
+            emit( now );
+        }
+    }
+
+    void emit( time_point now )
+    {
+        m_since_emit = 0;
+        m_last_emit  = now;
+        updated.notify( stats() );
+    }
+
+public:
+    template< typename S >
+    basic_window_aggregator( S &source, std::size_t window_samples, std::size_t emit_every = 0 )
+            : m_window_samples( window_samples ? window_samples : 1 )
+            , m_emit_every( emit_every ? emit_every : m_window_samples )
+    {
+        connect( source, [ this ]( double value ){ add( value ); } );
+    }
+
+    template< typename S >
+    basic_window_aggregator( S &source, duration window_period, duration emit_interval )
+            : m_window_period( window_period )
+            , m_emit_interval( emit_interval )
+    {
+        connect( source, [ this ]( double value ){ add( value ); } );
+    }
+
+    // Expires samples that left a time window and emits when the interval elapsed,
+    // for when the source has gone quiet.
+    void advance( time_point now = clock::now() )
+    {
+        if( m_window_samples )
+        {
+            return;
+        }
+
+        expire( now );
+        if( now - m_last_emit >= m_emit_interval )
+        {
+            emit( now );
+        }
+    }
+
+    window_stats stats() const noexcept
+    {
+        window_stats s;
+
+        s.count = m_samples.size();
+        if( s.count )
+        {
+            s.sum = m_sum + m_compensation;
+            s.min = m_min.front().value;
+            s.max = m_max.front().value;
+
+            const double q[] = { 0.50, 0.90, 0.99 };
+            double       p[ 3 ];
+            m_histogram.quantiles( q, p, 3, s.count );
+            s.p50 = std::clamp( p[ 0 ], s.min, s.max );
+            s.p90 = std::clamp( p[ 1 ], s.min, s.max );
+            s.p99 = std::clamp( p[ 2 ], s.min, s.max );
+        }
+
+        return s;
+    }
+};
+
+using window_aggregator = basic_window_aggregator<>;
+
+}